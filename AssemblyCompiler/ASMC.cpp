@@ -1,246 +1,759 @@
 #include <iostream>
 #include <string>
 #include <cstring>
-#include <cassert>
-#include <regex>
 #include <vector>
-#include <map>
+#include <stdexcept>
+#include <csignal>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "libasmc.h"
 using namespace std;
-#define MAX_LENGTH 200
 
-enum class Inst
+// Run the program over every triple of a CSV ("x,y,z" per line) or binary
+// (int32 x, y, z records) file, streaming results in input order: CSV lines
+// "x,y,z" or "trap", or binary records x, y, z, trapped. Blank CSV lines are
+// skipped. A malformed line or a truncated record ends the run with an error
+// after the results before it, and the return value is 1.
+int batch(const vector<ASM> &list, const char *path, bool binary)
 {
-    ADD, SUB, MUL, DIV, REM, STORE, LOAD, CE, INVALID
-};
-enum class Data
-{
-    MEM, REG, VAL, INVALID
-};
-struct ASM
-{
-    Inst inst;
-    struct Operand
-    {
-        int val;
-        Data type;
-        Operand() : val(0), type(Data::INVALID) {}
-        Operand(int t1, Data t2) : val(t1), type(t2) {}
-    } op[3];
-    ASM() : inst(Inst::INVALID) {}
-    ASM(const string &in) : ASM()
-    {
-        static char t1[30], t2[3][30];
-        if(in == "Compile Error!")
-            inst = Inst::CE;
-        else if(regex_match(in, regex(R"(^(add|sub|mul|div|rem) +r[0-9]+ +(r[0-9]+|[0-9]+) +(r[0-9]+|[0-9]+) *$)")))
-        {
-            sscanf(in.c_str(), "%s%s%s%s", t1, t2[0], t2[1], t2[2]);
-            if(!strcmp(t1, "add")) inst = Inst::ADD;
-            else if(!strcmp(t1, "sub")) inst = Inst::SUB;
-            else if(!strcmp(t1, "mul")) inst = Inst::MUL;
-            else if(!strcmp(t1, "div")) inst = Inst::DIV;
-            else inst = Inst::REM;
-            for(int i=0, tmp; i<3; i++)
+    FILE *in = fopen(path, binary ? "rb" : "r");
+    if(in == nullptr)
+    {
+        fprintf(stderr, "Cannot open %s.\n", path);
+        return 1;
+    }
+    Batch engine(list);
+    int xyz[Batch::LANES][3], out[Batch::LANES][3];
+    bool trap[Batch::LANES];
+    char *line = nullptr;
+    size_t cap = 0;
+    // lines: CSV lines or binary records read so far; bad: the one that failed.
+    long long lines = 0, bad = 0;
+    for(bool more = true; more; )
+    {
+        int n = 0;
+        while(n < Batch::LANES)
+        {
+            if(binary)
             {
-                if(t2[i][0] == 'r')
-                {
-                    sscanf(t2[i], "r%d", &tmp);
-                    op[i] = Operand(tmp, Data::REG);
-                    if(tmp >= 256 || tmp < 0) inst = Inst::INVALID;
-                }
-                else
-                {
-                    sscanf(t2[i], "%d", &tmp);
-                    op[i] = Operand(tmp, Data::VAL);
-                    if(tmp < 0) inst = Inst::INVALID;
-                }
+                size_t got = fread(xyz[n], sizeof(int), 3, in);
+                if(got == 0) { more = false; break; }
+                lines++;
+                if(got != 3) { bad = lines; more = false; break; }
+                n++;
+                continue;
             }
+            if(getline(&line, &cap, in) < 0) { more = false; break; }
+            lines++;
+            int end = 0;
+            if(line[strspn(line, " \t\r\n")] == '\0') continue;
+            if(sscanf(line, " %d ,%d ,%d %n", &xyz[n][0], &xyz[n][1], &xyz[n][2], &end) != 3 || line[end] != '\0')
+            {
+                bad = lines;
+                more = false;
+                break;
+            }
+            n++;
         }
-        else if(regex_match(in, regex(R"(^load +r[0-9]+ +\[[0-9]+\] *$)")))
-        {
-            sscanf(in.c_str(), "%*s r%d [%d]", &op[0].val, &op[1].val);
-            inst = Inst::LOAD;
-            op[0].type = Data::REG;
-            op[1].type = Data::MEM;
-            if(op[0].val >= 256 || op[0].val < 0) inst = Inst::INVALID;
-            if(op[1].val >= 256 || op[1].val < 0) inst = Inst::INVALID;
-        }
-        else if(regex_match(in, regex(R"(^store +\[[0-9]+\] +r[0-9]+ *$)")))
+        if(n == 0) break;
+        engine.run(xyz, n, out, trap);
+        for(int l=0; l<n; l++)
         {
-            sscanf(in.c_str(), "%*s [%d] r%d", &op[0].val, &op[1].val);
-            inst = Inst::STORE;
-            op[0].type = Data::MEM;
-            op[1].type = Data::REG;
-            if(op[0].val >= 256 || op[0].val < 0) inst = Inst::INVALID;
-            if(op[1].val >= 256 || op[1].val < 0) inst = Inst::INVALID;
+            if(binary)
+            {
+                int rec[4] = {out[l][0], out[l][1], out[l][2], trap[l]};
+                fwrite(rec, sizeof(int), 4, stdout);
+            }
+            else if(trap[l]) puts("trap");
+            else printf("%d,%d,%d\n", out[l][0], out[l][1], out[l][2]);
         }
     }
-    ASM(const char *in) : ASM(string(in)) {}
+    free(line);
+    fclose(in);
+    if(bad)
+    {
+        fflush(stdout);
+        fprintf(stderr, binary ? "%s: truncated record: %lld.\n" : "%s: bad input at line: %lld.\n", path, bad);
+        return 1;
+    }
+    return 0;
+}
+
+// Exhaustive sweep: evaluate the program at every point of the box
+// [lo[k], hi[k]] and, if ref is not null, compare against ref. The box is
+// cut into chunks of consecutive points; every thread owns an equal share
+// of the chunks and steals from the others once its own share runs out.
+// Threads only share the chunk cursors, so the sweep scales with cores.
+class Sweep
+{
+public:
+    Sweep(const vector<ASM> &list, const vector<ASM> *ref, const long long *lo, const long long *hi);
+    void run(int threads);
+    void report() const;
+
+private:
+    const static int CHUNK = 1 << 12;
+    struct alignas(64) Cursor
+    {
+        atomic<unsigned long long> next;
+        unsigned long long end;
+    };
+    struct alignas(64) Stats
+    {
+        unsigned long long hash[3] = {0, 0, 0};
+        unsigned long long traps = 0, ref_traps = 0;
+        unsigned long long mismatch = ULLONG_MAX;
+    };
+    Batch prog;
+    const Batch *ref;
+    Batch ref_prog;
+    long long lo[3];
+    unsigned long long dim[3], points, chunks;
+    vector<Cursor> cursor;
+    Stats total;
+    void work(int self, Stats &st);
+    void point(unsigned long long idx, int *xyz) const;
+    // Order-independent: the sum of a mix of (point, value) over all points.
+    static unsigned long long mix(unsigned long long idx, unsigned long long v);
 };
-struct REG
+
+Sweep::Sweep(const vector<ASM> &list, const vector<ASM> *reference, const long long *l, const long long *h)
+    : prog(list), ref(reference ? &ref_prog : nullptr), ref_prog(reference ? *reference : vector<ASM>()), points(1)
+{
+    for(int k=0; k<3; k++)
+    {
+        if(l[k] > h[k] || l[k] < INT_MIN || h[k] > INT_MAX) throw invalid_argument("Sweep: bad range");
+        lo[k] = l[k];
+        dim[k] = h[k] - l[k] + 1;
+        if(points > ULLONG_MAX / 2 / dim[k]) throw invalid_argument("Sweep: box too large");
+        points *= dim[k];
+    }
+    chunks = (points + CHUNK - 1) / CHUNK;
+}
+
+unsigned long long Sweep::mix(unsigned long long idx, unsigned long long v)
+{
+    unsigned long long h = idx * 0x9E3779B97F4A7C15ULL ^ (v + 0x632BE59BD9B4E019ULL);
+    h ^= h >> 31; h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 29; h *= 0x94D049BB133111EBULL;
+    return h ^ h >> 32;
+}
+
+// x varies slowest, z fastest, so point order matches nested x, y, z loops.
+void Sweep::point(unsigned long long idx, int *xyz) const
+{
+    for(int k=2; k>=0; k--)
+    {
+        xyz[k] = (int)(lo[k] + (long long)(idx % dim[k]));
+        idx /= dim[k];
+    }
+}
+
+void Sweep::run(int threads)
+{
+    // Clamp before widening, so a count below 1 cannot wrap to a huge one.
+    threads = (int)min<unsigned long long>(max(threads, 1), chunks);
+    cursor = vector<Cursor>(threads);
+    for(int t=0; t<threads; t++)
+    {
+        cursor[t].next = chunks * t / threads;
+        cursor[t].end = chunks * (t + 1) / threads;
+    }
+    vector<Stats> stats(threads);
+    vector<thread> pool;
+    for(int t=1; t<threads; t++)
+        pool.emplace_back(&Sweep::work, this, t, std::ref(stats[t]));
+    work(0, stats[0]);
+    for(auto &t : pool) t.join();
+    total = Stats();
+    for(const auto &st : stats)
+    {
+        for(int k=0; k<3; k++) total.hash[k] += st.hash[k];
+        total.traps += st.traps;
+        total.ref_traps += st.ref_traps;
+        total.mismatch = min(total.mismatch, st.mismatch);
+    }
+}
+
+void Sweep::work(int self, Stats &st)
 {
-    const static int MAX = 256;
-    int val[MAX];
-    REG() { memset(val, 0, sizeof(val)); }
-    int rw(int idx)
+    int n = cursor.size();
+    int xyz[Batch::LANES][3], out[Batch::LANES][3], ref_out[Batch::LANES][3];
+    bool trap[Batch::LANES], ref_trap[Batch::LANES];
+    for(int victim = self, tried = 0; tried < n; )
     {
-        assert(0 <= idx && idx < MAX);
-        return val[idx];
+        unsigned long long c = cursor[victim].next.fetch_add(1, memory_order_relaxed);
+        if(c >= cursor[victim].end)
+        {
+            victim = (victim + 1) % n;
+            tried++;
+            continue;
+        }
+        unsigned long long first = c * CHUNK, last = min(points, first + CHUNK);
+        for(unsigned long long base = first; base < last; base += Batch::LANES)
+        {
+            int m = (int)min<unsigned long long>(Batch::LANES, last - base);
+            for(int l=0; l<m; l++)
+                point(base + l, xyz[l]);
+            prog.run(xyz, m, out, trap);
+            if(ref) ref->run(xyz, m, ref_out, ref_trap);
+            for(int l=0; l<m; l++)
+            {
+                unsigned long long idx = base + l;
+                for(int k=0; k<3; k++)
+                    st.hash[k] += mix(idx, trap[l] ? 1ULL << 32 : (unsigned)out[l][k]);
+                st.traps += trap[l];
+                if(!ref) continue;
+                st.ref_traps += ref_trap[l];
+                if(idx < st.mismatch && (trap[l] != ref_trap[l] ||
+                   (!trap[l] && memcmp(out[l], ref_out[l], sizeof(out[l])))))
+                    st.mismatch = idx;
+            }
+        }
     }
-    void sw(int idx, int d)
+}
+
+void Sweep::report() const
+{
+    printf("Points = %llu\n", points);
+    printf("Hash = %016llx %016llx %016llx\n", total.hash[0], total.hash[1], total.hash[2]);
+    printf("Division traps = %llu\n", total.traps);
+    if(!ref) return;
+    printf("Reference division traps = %llu\n", total.ref_traps);
+    if(total.mismatch == ULLONG_MAX)
     {
-        assert(0 <= idx && idx < MAX);
-        val[idx] = d;
+        puts("No mismatch.");
+        return;
     }
-    void clear() { memset(val, 0, sizeof(val)); }
+    int xyz[1][3], out[1][3], ref_out[1][3];
+    bool trap[1], ref_trap[1];
+    point(total.mismatch, xyz[0]);
+    prog.run(xyz, 1, out, trap);
+    ref->run(xyz, 1, ref_out, ref_trap);
+    printf("First mismatch at x, y, z = %d, %d, %d\n", xyz[0][0], xyz[0][1], xyz[0][2]);
+    if(trap[0]) puts("  program:   trap");
+    else printf("  program:   %d, %d, %d\n", out[0][0], out[0][1], out[0][2]);
+    if(ref_trap[0]) puts("  reference: trap");
+    else printf("  reference: %d, %d, %d\n", ref_out[0][0], ref_out[0][1], ref_out[0][2]);
+}
+
+// Cycle profile of a program: cycles per line, a per-opcode histogram, the
+// cycles lost to the register penalty, the load/store share and the N
+// hottest lines. format is "text", "csv" or "json".
+class Profile
+{
+public:
+    Profile(const vector<ASM> &list, const vector<int> &lines, const Model &m);
+    void report(const string &format, int top) const;
+
+private:
+    const static int OPS = (int)Inst::CE;
+    struct Line
+    {
+        int line, cycles, penalty;
+        const ASM *inst;
+    };
+    vector<Line> rows;
+    long long count[OPS], cycles[OPS], penalty[OPS];
+    long long total, total_penalty, load_store;
+    int penalty_reg;
+    static const char *name(Inst inst) { return asmo_name[(int)inst]; }
+    vector<Line> hottest(int top) const;
+    static double share(long long part, long long whole) { return whole ? 100.0 * part / whole : 0; }
 };
-struct MEM
+
+Profile::Profile(const vector<ASM> &list, const vector<int> &lines, const Model &m)
+    : total(0), total_penalty(0), load_store(0), penalty_reg(m.penalty_reg)
+{
+    memset(count, 0, sizeof(count));
+    memset(cycles, 0, sizeof(cycles));
+    memset(penalty, 0, sizeof(penalty));
+    rows.reserve(list.size());
+    for(size_t k=0; k<list.size(); k++)
+    {
+        const ASM &i = list[k];
+        int op = (int)i.inst, c = cost(i, m), extra = c - base_cost(i.inst, m);
+        rows.push_back({k < lines.size() ? lines[k] : (int)k + 1, c, extra, &i});
+        count[op]++;
+        cycles[op] += c;
+        penalty[op] += extra;
+        total += c;
+        total_penalty += extra;
+        if(i.inst == Inst::LOAD || i.inst == Inst::STORE) load_store += c;
+    }
+}
+
+// Highest cycles first, earlier lines first among equals.
+vector<Profile::Line> Profile::hottest(int top) const
+{
+    vector<Line> res(rows);
+    auto hotter = [](const Line &a, const Line &b) { return a.cycles != b.cycles ? a.cycles > b.cycles : a.line < b.line; };
+    top = min<size_t>(max(top, 0), res.size());
+    partial_sort(res.begin(), res.begin() + top, res.end(), hotter);
+    res.resize(top);
+    return res;
+}
+
+void Profile::report(const string &format, int top) const
 {
-    const static int MAX = 256;
-    char *val;
-    MEM() { val = new char[MAX]; }
-    ~MEM() { delete val; }
-    int rw(int idx)
+    vector<Line> hot = hottest(top);
+    if(format == "csv")
+    {
+        puts("section,line,opcode,count,cycles,penalty,instruction");
+        for(const auto &r : rows)
+            printf("line,%d,%s,1,%d,%d,%s\n", r.line, name(r.inst->inst), r.cycles, r.penalty, r.inst->str().c_str());
+        for(int op=0; op<OPS; op++)
+            if(count[op])
+                printf("opcode,,%s,%lld,%lld,%lld,\n", name((Inst)op), count[op], cycles[op], penalty[op]);
+        for(const auto &r : hot)
+            printf("top,%d,%s,1,%d,%d,%s\n", r.line, name(r.inst->inst), r.cycles, r.penalty, r.inst->str().c_str());
+        printf("total,,,%zu,%lld,%lld,\n", rows.size(), total, total_penalty);
+        printf("load_store,,,,%lld,,\n", load_store);
+    }
+    else if(format == "json")
     {
-        assert(0 <= idx && idx < MAX);
-        int res;
-        memcpy(&res, val + idx, sizeof(int));
-        return res;
+        auto line = [](const Line &r, bool last) {
+            printf("    {\"line\": %d, \"opcode\": \"%s\", \"cycles\": %d, \"penalty\": %d, \"instruction\": \"%s\"}%s\n",
+                   r.line, name(r.inst->inst), r.cycles, r.penalty, r.inst->str().c_str(), last ? "" : ",");
+        };
+        puts("{");
+        puts("  \"lines\": [");
+        for(size_t k=0; k<rows.size(); k++) line(rows[k], k + 1 == rows.size());
+        puts("  ],");
+        puts("  \"opcodes\": {");
+        bool first = true;
+        for(int op=0; op<OPS; op++)
+            if(count[op])
+            {
+                printf("%s    \"%s\": {\"count\": %lld, \"cycles\": %lld, \"penalty\": %lld}", first ? "" : ",\n",
+                       name((Inst)op), count[op], cycles[op], penalty[op]);
+                first = false;
+            }
+        puts(first ? "  }," : "\n  },");
+        puts("  \"top\": [");
+        for(size_t k=0; k<hot.size(); k++) line(hot[k], k + 1 == hot.size());
+        puts("  ],");
+        printf("  \"total\": %lld,\n  \"penalty\": %lld,\n  \"load_store\": %lld\n}\n", total, total_penalty, load_store);
     }
-    void sw(int idx, int d)
+    else
     {
-        assert(0 <= idx && idx < MAX);
-        memcpy(val + idx, &d, sizeof(int));
+        puts(" line  cycles  penalty  instruction");
+        for(const auto &r : rows)
+            printf("%5d  %6d  %7d  %s\n", r.line, r.cycles, r.penalty, r.inst->str().c_str());
+        puts("\nopcode   count    cycles   penalty  share");
+        for(int op=0; op<OPS; op++)
+            if(count[op])
+                printf("%-6s  %6lld  %8lld  %8lld  %5.1f%%\n", name((Inst)op), count[op], cycles[op], penalty[op], share(cycles[op], total));
+        printf("\nTotal cycle = %lld\n", total);
+        printf("Penalty cycles (r%d and above) = %lld (%.1f%%)\n", penalty_reg, total_penalty, share(total_penalty, total));
+        printf("Load/store cycles = %lld (%.1f%%)\n", load_store, share(load_store, total));
+        if(hot.empty()) return;
+        printf("\nTop %zu:\n", hot.size());
+        for(const auto &r : hot)
+            printf("%5d  %6d  %7d  %s\n", r.line, r.cycles, r.penalty, r.inst->str().c_str());
     }
+}
+
+// Dependency-aware timing. Each instruction takes cost() cycles and may
+// start once the registers and memory bytes it reads have been written;
+// there is no other ordering, as if the core renamed freely. schedule(0) is
+// the critical path; schedule(W) places instructions in program order at the
+// first cycle, no earlier than their inputs, with fewer than W issued.
+class Timing
+{
+public:
+    struct Result
+    {
+        long long cycles;
+        int path;       // instructions on the longest chain
+        int loads;      // most loads in flight at once
+    };
+    Timing(const vector<ASM> &list, const Model &m) : list(list), model(m) {}
+    Result schedule(int width) const;
+
+private:
+    const vector<ASM> &list;
+    const Model &model;
 };
-vector<ASM> asm_list;
 
-// Return false if the ASM is invalid.
-bool insert_ASM(const string &in)
+Timing::Result Timing::schedule(int width) const
 {
-    if(regex_match(in, regex(R"(^ *$)"))) return true;
-    asm_list.emplace_back(ASM(in));
-    if(asm_list.back().inst == Inst::INVALID) return false;
-    return true;
+    struct Ready
+    {
+        long long at = 0;
+        int path = 0;
+    };
+    vector<Ready> reg(model.regs), mem(model.mem + sizeof(int));
+    // Issue slots used per cycle, and for full cycles a link to a later one.
+    unordered_map<long long, int> used;
+    unordered_map<long long, long long> next;
+    // Two passes, no recursion: a chain of full cycles can be as long as the program.
+    auto slot = [&](long long t) {
+        long long root = t;
+        for(auto it = next.find(root); it != next.end(); it = next.find(root))
+            root = it->second;
+        while(t != root)
+        {
+            long long &link = next[t];
+            t = link;
+            link = root;
+        }
+        return root;
+    };
+    vector<pair<long long, int>> loads;
+    Result res = {0, 0, 0};
+    for(const auto &i : list)
+    {
+        if(i.inst == Inst::CE || i.inst == Inst::INVALID) break;
+        Ready in;
+        auto need = [&](const Ready &r) { if(r.at > in.at) in.at = r.at; in.path = max(in.path, r.path); };
+        for(int idx=1; idx<3; idx++)
+            if(i.op[idx].type == Data::REG) need(reg[i.op[idx].val]);
+            else if(i.op[idx].type == Data::MEM)
+                for(int k=0; k<(int)sizeof(int); k++) need(mem[i.op[idx].val + k]);
+        long long issue = in.at;
+        if(width > 0)
+        {
+            issue = slot(issue);
+            if(++used[issue] == width) next[issue] = issue + 1;
+        }
+        Ready out = {issue + cost(i, model), in.path + 1};
+        if(i.inst == Inst::STORE)
+            for(int k=0; k<(int)sizeof(int); k++) mem[i.op[0].val + k] = out;
+        else reg[i.op[0].val] = out;
+        if(i.inst == Inst::LOAD)
+        {
+            loads.push_back({issue, 1});
+            loads.push_back({out.at, -1});
+        }
+        if(out.at > res.cycles || (out.at == res.cycles && out.path > res.path)) res.cycles = out.at, res.path = out.path;
+    }
+    // Ends sort before starts at the same cycle, so back-to-back loads do not overlap.
+    sort(loads.begin(), loads.end());
+    for(int k=0, now=0; k<(int)loads.size(); k++)
+        res.loads = max(res.loads, now += loads[k].second);
+    return res;
 }
 
-// Return -1 if there exists a "CE" instruction.
-tuple<int, int, int> evaluate(const vector<ASM> &list, const vector<int> &xyz = vector<int>())
+// Decode, execute and charge each line of in as it arrives, keeping only one
+// line in memory. The output is the same as buffering the program first: an
+// invalid line is reported before anything else, and a division that traps
+// only takes the process down once the whole input has been validated.
+int stream(istream &in, const vector<int> &xyz, const Model &m)
 {
-    REG reg;
-    MEM mem;
-    int val[3];
+    REG reg(m);
+    MEM mem(m);
     for(int i=0; i<(int)xyz.size(); i++)
         mem.sw(i * 4, xyz[i]);
-    for(const auto &i : list)
+    bool running = true, ce = false, trapped = false;
+    long long total = 0;
+    string str;
+    for(int lines = 1; getline(in, str); lines++)
     {
-        for(int idx=0; idx<3; idx++)
+        if(str.find_first_not_of(' ') == string::npos) continue;
+        ASM i(str, m);
+        if(i.inst == Inst::INVALID)
+        {
+            printf("Instruction invalid at line: %d.\n", lines);
+            return 0;
+        }
+        int c = cost(i, m);
+        if(c == -1) ce = true;
+        else total += c;
+        if(!running) continue;
+        if(i.inst == Inst::DIV || i.inst == Inst::REM)
         {
-            switch(i.op[idx].type)
+            int x = i.op[1].type == Data::REG ? reg.rw(i.op[1].val) : i.op[1].val;
+            int y = i.op[2].type == Data::REG ? reg.rw(i.op[2].val) : i.op[2].val;
+            if(y == 0 || (x == INT_MIN && y == -1))
             {
-                case Data::REG:
-                    val[idx] = reg.rw(i.op[idx].val);
-                    break;
-                case Data::MEM:
-                    val[idx] = mem.rw(i.op[idx].val);
-                    break;
-                case Data::VAL:
-                    val[idx] = i.op[idx].val;
-                    break;
-                default:
-                    break;
+                trapped = true;
+                running = false;
+                continue;
             }
         }
-        switch(i.inst)
+        running = execute(i, reg, mem);
+    }
+    if(trapped) raise(SIGFPE);
+    if(ce) puts("CE instruction found.");
+    else printf("x, y, z = %d, %d, %d\nTotal cycle = %lld\n", mem.rw(0), mem.rw(4), mem.rw(8), total);
+    return 0;
+}
+
+// Read a text ASM file into list. Return false if it cannot be read or is invalid.
+bool load_ASM(const char *path, vector<ASM> &list, const Model &m)
+{
+    ifstream in(path);
+    if(!in)
+    {
+        fprintf(stderr, "Cannot open %s.\n", path);
+        return false;
+    }
+    string str;
+    for(int lines = 1; getline(in, str); lines++)
+        if(!insert_ASM(list, str, m))
         {
-            case Inst::ADD:
-                reg.sw(i.op[0].val, val[1] + val[2]);
-                break;
-            case Inst::SUB:
-                reg.sw(i.op[0].val, val[1] - val[2]);
-                break;
-            case Inst::MUL:
-                reg.sw(i.op[0].val, val[1] * val[2]);
-                break;
-            case Inst::DIV:
-                reg.sw(i.op[0].val, val[1] / val[2]);
-                break;
-            case Inst::REM:
-                reg.sw(i.op[0].val, val[1] % val[2]);
-                break;
-            case Inst::STORE:
-                mem.sw(i.op[0].val, val[1]);
-                break;
-            case Inst::LOAD:
-                reg.sw(i.op[0].val, val[1]);
-                break;
-            case Inst::CE:
-                return {mem.rw(0), mem.rw(4), mem.rw(8)};
-            default:
-                break;
+            fprintf(stderr, "%s: Instruction invalid at line: %d.\n", path, lines);
+            return false;
         }
+    return true;
+}
+
+// Copy the records of an object image into list. Return 0, or the 1-based
+// index of the first invalid record, -1 if the header is wrong, or -2 if the
+// image ends inside a record.
+int insert_object(const char *data, size_t size, vector<ASM> &list, const Model &m)
+{
+    if(size < sizeof(AsmoHeader) || !asmo_check_header((const AsmoHeader *)data)) return -1;
+    if((size - sizeof(AsmoHeader)) % sizeof(AsmoInst) != 0) return -2;
+    size_t n = (size - sizeof(AsmoHeader)) / sizeof(AsmoInst);
+    list.reserve(list.size() + n);
+    for(size_t i=0; i<n; i++)
+    {
+        AsmoInst rec;
+        memcpy(&rec, data + sizeof(AsmoHeader) + i * sizeof(AsmoInst), sizeof(rec));
+        list.emplace_back(rec, m);
+        if(list.back().inst == Inst::INVALID) return i + 1;
     }
-    return {mem.rw(0), mem.rw(4), mem.rw(8)};
+    return 0;
 }
 
-// Return -1 if there exists a "CE" instruction.
-int cycle(const vector<ASM> &list)
+// Read a binary ASM object ("-" for stdin) into list. A file is mapped, not
+// read, and its records need no decoding. Same return value as insert_object.
+int load_object(const char *path, vector<ASM> &list, const Model &m)
 {
-    const static map<Inst, int> cost = {
-        {Inst::ADD, 10}, {Inst::SUB, 10}, 
-        {Inst::MUL, 30}, {Inst::DIV, 50}, 
-        {Inst::REM, 60}, {Inst::STORE, 200}, 
-        {Inst::LOAD, 200}
-    };
-    int cycle = 0, tmp;
-    for(const auto &i : list)
+    if(!strcmp(path, "-"))
     {
-        int penalty = 0;
-        switch(i.inst)
-        {
-            case Inst::ADD:
-            case Inst::SUB:
-            case Inst::MUL:
-            case Inst::DIV:
-            case Inst::REM:
-            case Inst::STORE:
-            case Inst::LOAD:
-                tmp = cost.at(i.inst);
-                for(const auto &op : i.op)
-                    if(op.type == Data::REG && op.val >= 8)
-                        penalty = 1;
-                break;
-            case Inst::CE:
-                return -1;
-            default:
-                break;
-        }
-        cycle += tmp * (1 + penalty);
+        vector<char> data;
+        char buf[1 << 16];
+        for(size_t n; (n = fread(buf, 1, sizeof(buf), stdin)) > 0; )
+            data.insert(data.end(), buf, buf + n);
+        return insert_object(data.data(), data.size(), list, m);
     }
-    return cycle;
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st))
+    {
+        fprintf(stderr, "Cannot open %s.\n", path);
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+    void *data = st.st_size ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(data == MAP_FAILED) return -1;
+    int res = insert_object((const char *)data, st.st_size, list, m);
+    munmap(data, st.st_size);
+    return res;
 }
 
-// ./ASMC x y z
+// ./ASMC [--engine=threaded|switch|jit] x y z
+// ./ASMC --batch=FILE [--binary]
+// ./ASMC --sweep=X0:X1,Y0:Y1,Z0:Z1 [--threads=N] [--reference=FILE]
+// ./ASMC [--object=FILE|-] [--disasm|--assemble]
+// ./ASMC --stream x y z
+// ./ASMC --profile[=text|csv|json] [--top=N]
+// ./ASMC --timing [--issue=W]
+// Any mode: [--model=FILE] [--regs=N] [--mem=N] [--cost-OP=N] [--penalty-reg=N] [--penalty-factor=N]
 int main(int argc, char **argv)
 {
+    Model model;
     vector<int> init;
-    if(argc == 4)
-        for(int i=1; i<argc; i++)
-            init.emplace_back(atoi(argv[i]));
-    else init = {2, 3, 5};
-    string str;
-    int lines = 1;
-    while(getline(cin, str))
+    string engine = "threaded";
+    const char *batch_file = nullptr, *sweep_box = nullptr, *ref_file = nullptr, *object = nullptr;
+    bool binary = false, disasm = false, assemble = false, streaming = false;
+    const char *profile = nullptr;
+    int threads = thread::hardware_concurrency(), top = 10, issue = 0;
+    for(int i=1; i<argc; i++)
     {
-        if(!insert_ASM(str))
+        if(!strncmp(argv[i], "--engine=", 9))
         {
-            printf("Instruction invalid at line: %d.\n", lines);
+            engine = argv[i] + 9;
+            if(engine != "threaded" && engine != "switch" && engine != "jit")
+            {
+                fprintf(stderr, "Unknown engine %s, use threaded, switch or jit.\n", argv[i] + 9);
+                return 1;
+            }
+        }
+        else if(!strncmp(argv[i], "--batch=", 8)) batch_file = argv[i] + 8;
+        else if(!strcmp(argv[i], "--binary")) binary = true;
+        else if(!strncmp(argv[i], "--sweep=", 8)) sweep_box = argv[i] + 8;
+        else if(!strncmp(argv[i], "--threads=", 10))
+        {
+            threads = atoi(argv[i] + 10);
+            if(threads < 1)
+            {
+                fprintf(stderr, "Bad thread count %s.\n", argv[i] + 10);
+                return 1;
+            }
+        }
+        else if(!strncmp(argv[i], "--reference=", 12)) ref_file = argv[i] + 12;
+        else if(!strncmp(argv[i], "--object=", 9)) object = argv[i] + 9;
+        else if(!strcmp(argv[i], "--disasm")) disasm = true;
+        else if(!strcmp(argv[i], "--assemble")) assemble = true;
+        else if(!strcmp(argv[i], "--stream")) streaming = true;
+        else if(!strcmp(argv[i], "--profile")) profile = "text";
+        else if(!strncmp(argv[i], "--profile=", 10)) profile = argv[i] + 10;
+        else if(!strncmp(argv[i], "--top=", 6)) top = atoi(argv[i] + 6);
+        else if(!strcmp(argv[i], "--timing")) issue = max(issue, 1);
+        else if(!strncmp(argv[i], "--issue=", 8)) issue = max(1, atoi(argv[i] + 8));
+        else if(!strncmp(argv[i], "--model=", 8))
+        {
+            if(!model.load(argv[i] + 8)) return 1;
+        }
+        else if(!strncmp(argv[i], "--", 2) && strchr(argv[i], '='))
+        {
+            const char *eq = strchr(argv[i], '=');
+            if(!model.set(string((const char *)argv[i] + 2, eq), atoi(eq + 1)))
+            {
+                fprintf(stderr, "Unknown option or value out of range: %s.\n", argv[i]);
+                return 1;
+            }
+        }
+        else init.emplace_back(atoi(argv[i]));
+    }
+    if(init.size() != 3) init = {2, 3, 5};
+    ios::sync_with_stdio(false);
+    if(streaming) return stream(cin, init, model);
+    Program prog;
+    if(object != nullptr)
+    {
+        vector<ASM> list;
+        int bad = load_object(object, list, model);
+        if(bad == -1)
+        {
+            puts("Invalid object file.");
+            return 0;
+        }
+        if(bad == -2)
+        {
+            puts("Truncated object file.");
+            return 0;
+        }
+        if(bad)
+        {
+            printf("Instruction invalid at line: %d.\n", bad);
+            return 0;
+        }
+        prog = Program(move(list), vector<int>(), model);
+    }
+    else prog = Program(cin, model);
+    if(prog.bad())
+    {
+        printf("Instruction invalid at line: %d.\n", prog.bad());
+        return 0;
+    }
+    const vector<ASM> &list = prog.list();
+    if(disasm)
+    {
+        for(const auto &i : list)
+            puts(i.str().c_str());
+        return 0;
+    }
+    if(assemble)
+    {
+        for(const auto &i : list)
+            if(i.op[0].val > 0xFF)
+            {
+                fprintf(stderr, "%s does not fit the object format.\n", i.str().c_str());
+                return 1;
+            }
+        asmo_write_header(stdout);
+        for(const auto &i : list)
+        {
+            AsmoInst rec = i.record();
+            fwrite(&rec, sizeof(rec), 1, stdout);
+        }
+        return 0;
+    }
+    if(issue > 0)
+    {
+        int C = prog.cycle();
+        if(C == -1)
+        {
+            puts("CE instruction found.");
+            return 0;
+        }
+        Timing timing(list, model);
+        Timing::Result path = timing.schedule(0), sched = timing.schedule(issue);
+        printf("Total cycle = %d\n", C);
+        printf("Critical path = %lld (%d instructions)\n", path.cycles, path.path);
+        printf("Issue width %d = %lld\n", issue, sched.cycles);
+        printf("Overlapping loads = %d (unbounded issue %d)\n", sched.loads, path.loads);
+        return 0;
+    }
+    if(profile != nullptr)
+    {
+        if(prog.cycle() == -1)
+        {
+            puts("CE instruction found.");
+            return 0;
+        }
+        Profile(list, prog.lines(), model).report(profile, top);
+        return 0;
+    }
+    if(batch_file != nullptr)
+    {
+        int C = prog.cycle();
+        if(C == -1)
+        {
+            puts("CE instruction found.");
+            return 0;
+        }
+        fprintf(stderr, "Total cycle = %d\n", C);
+        return batch(list, batch_file, binary);
+    }
+    if(sweep_box != nullptr)
+    {
+        long long lo[3], hi[3];
+        if(sscanf(sweep_box, "%lld:%lld,%lld:%lld,%lld:%lld", &lo[0], &hi[0], &lo[1], &hi[1], &lo[2], &hi[2]) != 6)
+        {
+            fprintf(stderr, "Bad sweep box %s.\n", sweep_box);
+            return 1;
+        }
+        vector<ASM> ref_list;
+        if(ref_file != nullptr && !load_ASM(ref_file, ref_list, model)) return 1;
+        if(prog.cycle() == -1 || (ref_file != nullptr && cycle(ref_list, model) == -1))
+        {
+            puts("CE instruction found.");
             return 0;
         }
-        lines++;
+        try
+        {
+            Sweep sweep(list, ref_file ? &ref_list : nullptr, lo, hi);
+            sweep.run(threads);
+            sweep.report();
+        }
+        catch(const invalid_argument &e)
+        {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+        return 0;
+    }
+    tuple<int, int, int> ans;
+    int C;
+#if defined(__x86_64__)
+    if(engine == "jit")
+    {
+        Jit jit(list, model);
+        ans = jit.run(init);
+        C = jit.cycle();
+    }
+    else
+#else
+    if(engine == "jit") fputs("The jit engine needs x86-64, running threaded.\n", stderr);
+#endif
+    {
+        ans = engine == "switch" ? evaluate(list, init, model) : Machine(model).run(prog, init[0], init[1], init[2]);
+        C = prog.cycle();
     }
-    auto ans = evaluate(asm_list, init);
-    int C = cycle(asm_list);
     if(C != -1) printf("x, y, z = %d, %d, %d\nTotal cycle = %d\n", get<0>(ans), get<1>(ans), get<2>(ans), C);
     else puts("CE instruction found.");
     return 0;
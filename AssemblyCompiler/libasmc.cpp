@@ -0,0 +1,623 @@
+#include <algorithm>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "libasmc.h"
+using namespace std;
+
+// Longest line of a --model file.
+constexpr int MAX_LENGTH = 200;
+
+const Model &Model::standard()
+{
+    static const Model res;
+    return res;
+}
+
+bool Model::set(const string &key, int val)
+{
+    static const char *const names[] = {"cost-add", "cost-sub", "cost-mul", "cost-div", "cost-rem", "cost-store", "cost-load"};
+    int *field = nullptr, low = 0, high = INT_MAX;
+    // The x, y, z image needs three registers to load into and 12 bytes of memory.
+    if(key == "regs") field = &regs, low = 3, high = MAX_REGS;
+    else if(key == "mem") field = &mem, low = 12, high = MAX_MEMORY;
+    else if(key == "penalty-reg") field = &penalty_reg;
+    else if(key == "penalty-factor") field = &penalty_factor;
+    for(int i=0; i<(int)Inst::CE; i++)
+        if(key == names[i]) field = &cost[i];
+    if(field == nullptr || val < low || val > high) return false;
+    *field = val;
+    Model standard;
+    custom = regs != standard.regs || mem != standard.mem || memcmp(cost, standard.cost, sizeof(cost)) ||
+             penalty_reg != standard.penalty_reg || penalty_factor != standard.penalty_factor;
+    return true;
+}
+
+bool Model::load(const char *path)
+{
+    FILE *in = fopen(path, "r");
+    if(in == nullptr)
+    {
+        fprintf(stderr, "Cannot open %s.\n", path);
+        return false;
+    }
+    char line[MAX_LENGTH], key[MAX_LENGTH];
+    int val;
+    bool ok = true;
+    for(int lines = 1; ok && fgets(line, sizeof(line), in); lines++)
+    {
+        char *p = line + strspn(line, " \t");
+        if(*p == '#' || *p == '\n' || *p == '\0') continue;
+        if(sscanf(p, "%[^ \t=] = %d", key, &val) != 2 || !set(key, val))
+        {
+            fprintf(stderr, "%s: bad model entry at line: %d.\n", path, lines);
+            ok = false;
+        }
+    }
+    fclose(in);
+    return ok;
+}
+// Register count and memory bytes (padded for the last word) that a program
+// touches, never less than the x, y, z image.
+void footprint(const vector<ASM> &list, int &regs, int &mems)
+{
+    regs = 0;
+    mems = 3 * sizeof(int);
+    for(const auto &i : list)
+    {
+        if(i.inst == Inst::CE || i.inst == Inst::INVALID) break;
+        for(const auto &op : i.op)
+        {
+            if(op.type == Data::REG) regs = max(regs, op.val + 1);
+            if(op.type == Data::MEM) mems = max(mems, op.val + (int)sizeof(int));
+        }
+    }
+}
+// Return false if the ASM is invalid.
+bool insert_ASM(vector<ASM> &list, const string &in, const Model &m)
+{
+    if(in.find_first_not_of(' ') == string::npos) return true;
+    list.emplace_back(ASM(in, m));
+    if(list.back().inst == Inst::INVALID) return false;
+    return true;
+}
+
+// Execute one instruction. Return false if it is a "CE" instruction.
+bool execute(const ASM &i, REG &reg, MEM &mem)
+{
+    int val[3];
+    for(int idx=0; idx<3; idx++)
+    {
+        switch(i.op[idx].type)
+        {
+            case Data::REG:
+                val[idx] = reg.rw(i.op[idx].val);
+                break;
+            case Data::MEM:
+                val[idx] = mem.rw(i.op[idx].val);
+                break;
+            case Data::VAL:
+                val[idx] = i.op[idx].val;
+                break;
+            default:
+                break;
+        }
+    }
+    switch(i.inst)
+    {
+        case Inst::ADD:
+            reg.sw(i.op[0].val, val[1] + val[2]);
+            break;
+        case Inst::SUB:
+            reg.sw(i.op[0].val, val[1] - val[2]);
+            break;
+        case Inst::MUL:
+            reg.sw(i.op[0].val, val[1] * val[2]);
+            break;
+        case Inst::DIV:
+            reg.sw(i.op[0].val, val[1] / val[2]);
+            break;
+        case Inst::REM:
+            reg.sw(i.op[0].val, val[1] % val[2]);
+            break;
+        case Inst::STORE:
+            mem.sw(i.op[0].val, val[1]);
+            break;
+        case Inst::LOAD:
+            reg.sw(i.op[0].val, val[1]);
+            break;
+        case Inst::CE:
+            return false;
+        default:
+            break;
+    }
+    return true;
+}
+
+// Return -1 if there exists a "CE" instruction.
+tuple<int, int, int> evaluate(const vector<ASM> &list, const vector<int> &xyz, const Model &m)
+{
+    REG reg(m);
+    MEM mem(m);
+    for(int i=0; i<(int)xyz.size(); i++)
+        mem.sw(i * 4, xyz[i]);
+    for(const auto &i : list)
+        if(!execute(i, reg, mem))
+            break;
+    return {mem.rw(0), mem.rw(4), mem.rw(8)};
+}
+
+Threaded::Threaded(const vector<ASM> &list, const Model &m)
+{
+    const void *const *table = exec(nullptr, nullptr, nullptr, nullptr);
+    footprint(list, regs, mems);
+    code.reserve(list.size() + 1);
+    // Add/sub/mul that fit an Alu; the rest break a block.
+    auto packed = [&](const ASM &i) {
+        if(i.inst != Inst::ADD && i.inst != Inst::SUB && i.inst != Inst::MUL) return false;
+        for(const auto &op : i.op)
+            if(op.type == Data::REG && op.val > UINT16_MAX) return false;
+        return true;
+    };
+    for(size_t k=0; k<list.size(); k++)
+    {
+        const ASM &i = list[k];
+        Op o = {nullptr, i.op[0].val, i.op[1].val, i.op[2].val};
+        int h;
+        if(packed(i) && k + 1 < list.size() && packed(list[k+1]))
+        {
+            o = {table[BLOCK], 0, (int)alu.size(), 0};
+            for(; k < list.size() && packed(list[k]); k++, o.b++)
+            {
+                const ASM &j = list[k];
+                bool ia = j.op[1].type == Data::VAL, ib = j.op[2].type == Data::VAL;
+                assert(0 <= j.op[0].val && j.op[0].val < m.regs);
+                assert(ia || (0 <= j.op[1].val && j.op[1].val < m.regs));
+                assert(ib || (0 <= j.op[2].val && j.op[2].val < m.regs));
+                Alu a = {(uint16_t)j.op[0].val, (uint16_t)(ia ? 0 : j.op[1].val), (uint16_t)(ib ? 0 : j.op[2].val),
+                         (int8_t)-!ia, (int8_t)-ia, (int8_t)-!ib, (int8_t)-(ib && !ia),
+                         (int8_t)-(j.inst == Inst::SUB), (int8_t)-(j.inst == Inst::MUL), ia ? j.op[1].val : ib ? j.op[2].val : 0};
+                if(ia && ib)
+                {
+                    unsigned x = j.op[1].val, y = j.op[2].val;
+                    a.imm = (int)(j.inst == Inst::ADD ? x + y : j.inst == Inst::SUB ? x - y : x * y);
+                    a.neg = a.mul = 0;
+                }
+                alu.push_back(a);
+            }
+            k--;
+            code.push_back(o);
+            continue;
+        }
+        switch(i.inst)
+        {
+            case Inst::ADD:
+            case Inst::SUB:
+            case Inst::MUL:
+            case Inst::DIV:
+            case Inst::REM:
+                assert(0 <= o.d && o.d < m.regs);
+                for(int idx=1; idx<3; idx++)
+                    assert(i.op[idx].type == Data::VAL || (0 <= i.op[idx].val && i.op[idx].val < m.regs));
+                h = ((int)i.inst - (int)Inst::ADD) * 4 + (i.op[1].type == Data::VAL) * 2 + (i.op[2].type == Data::VAL);
+                break;
+            case Inst::LOAD:
+                assert(0 <= o.d && o.d < m.regs && 0 <= o.a && o.a < m.mem);
+                h = LOAD;
+                break;
+            case Inst::STORE:
+                assert(0 <= o.d && o.d < m.mem && 0 <= o.a && o.a < m.regs);
+                h = STORE;
+                break;
+            default:
+                h = HALT;
+                break;
+        }
+        o.go = table[h];
+        code.push_back(o);
+        if(h == HALT) return;
+    }
+    code.push_back({table[HALT], 0, 0, 0});
+}
+
+tuple<int, int, int> Threaded::run(const vector<int> &xyz) const
+{
+    Scratch<int, REG::MAX> reg(regs);
+    Scratch<char, MEM::MAX + sizeof(int)> mem(mems);
+    for(int i=0; i<(int)xyz.size(); i++)
+        memcpy(mem.data + i * 4, &xyz[i], sizeof(int));
+    exec(code.data(), alu.data(), reg.data, mem.data);
+    int res[3];
+    memcpy(res, mem.data, sizeof(res));
+    return {res[0], res[1], res[2]};
+}
+
+const void *const *Threaded::exec(const Op *pc, const Alu *alu, int *reg, char *mem)
+{
+    static const void *const table[] = {
+        &&add_rr, &&add_ri, &&add_ir, &&add_ii,
+        &&sub_rr, &&sub_ri, &&sub_ir, &&sub_ii,
+        &&mul_rr, &&mul_ri, &&mul_ir, &&mul_ii,
+        &&div_rr, &&div_ri, &&div_ir, &&div_ii,
+        &&rem_rr, &&rem_ri, &&rem_ir, &&rem_ii,
+        &&load, &&store, &&halt, &&block
+    };
+    if(pc == nullptr) return table;
+    goto *pc->go;
+// add/sub/mul wrap around like the machine does; div/rem trap on zero like evaluate().
+#define ARITH(name, expr)\
+    name##_rr: { int x = reg[pc->a], y = reg[pc->b]; reg[pc->d] = (expr); goto *(++pc)->go; }\
+    name##_ri: { int x = reg[pc->a], y = pc->b; reg[pc->d] = (expr); goto *(++pc)->go; }\
+    name##_ir: { int x = pc->a, y = reg[pc->b]; reg[pc->d] = (expr); goto *(++pc)->go; }\
+    name##_ii: { int x = pc->a, y = pc->b; reg[pc->d] = (expr); goto *(++pc)->go; }
+    ARITH(add, (int)((unsigned)x + (unsigned)y))
+    ARITH(sub, (int)((unsigned)x - (unsigned)y))
+    ARITH(mul, (int)((unsigned)x * (unsigned)y))
+    ARITH(div, x / y)
+    ARITH(rem, x % y)
+#undef ARITH
+load:
+    memcpy(reg + pc->d, mem + pc->a, sizeof(int));
+    goto *(++pc)->go;
+store:
+    memcpy(mem + pc->d, reg + pc->a, sizeof(int));
+    goto *(++pc)->go;
+block:
+    // Masks instead of branches: the opcode mix of a block is unpredictable.
+    for(const Alu *i = alu + pc->a, *end = i + pc->b; i != end; i++)
+    {
+        unsigned imm = i->imm, neg = i->neg, mul = i->mul;
+        unsigned x = ((unsigned)reg[i->a] & i->ra) | (imm & i->ia);
+        unsigned y = ((unsigned)reg[i->b] & i->rb) | (imm & i->ib);
+        unsigned s = x + ((y ^ neg) - neg);
+        reg[i->d] = (int)((x * y & mul) | (s & ~mul));
+    }
+    goto *(++pc)->go;
+halt:
+    return table;
+}
+
+#if defined(__x86_64__)
+Jit::Jit(const vector<ASM> &list, const Model &m) : frame(0), buf(MAP_FAILED), size(0), cost(::cycle(list, m)), fn(nullptr)
+{
+    int regs;
+    footprint(list, regs, mems);
+    for(const auto &i : list)
+    {
+        if(i.inst == Inst::CE || i.inst == Inst::INVALID) break;
+        for(const auto &op : i.op)
+            if(op.type == Data::REG && op.val >= NATIVE)
+                frame = max(frame, (op.val + 2) / 2 * 8);
+    }
+    // push r12-r15; zero r8d-r15d
+    byte({0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+    for(int k=0; k<NATIVE; k++)
+        byte({0x45, 0x31, 0xC0 | k << 3 | k});
+    if(frame)
+    {
+        // sub rsp, frame; clear it with rep stosq
+        byte({0x48, 0x81, 0xEC}); imm32(frame);
+        byte({0x48, 0x89, 0xFA, 0x48, 0x89, 0xE7, 0x31, 0xC0, 0xB9}); imm32(frame / 8);
+        byte({0xF3, 0x48, 0xAB, 0x48, 0x89, 0xD7});
+    }
+    for(const auto &i : list)
+    {
+        if(i.inst == Inst::CE || i.inst == Inst::INVALID) break;
+        switch(i.inst)
+        {
+            case Inst::LOAD:
+                byte({0x8B}); addr(0, false, i.op[1].val);  // mov eax, [rdi+a]
+                put(i.op[0].val);
+                continue;
+            case Inst::STORE:
+                fetch(0, i.op[1]);
+                byte({0x89}); addr(0, false, i.op[0].val);  // mov [rdi+d], eax
+                continue;
+            default:
+                break;
+        }
+        fetch(0, i.op[1]);
+        if(i.op[2].type == Data::VAL && i.inst != Inst::DIV && i.inst != Inst::REM)
+        {
+            int v = i.op[2].val;
+            bool small = -128 <= v && v < 128;
+            switch(i.inst)
+            {
+                case Inst::ADD: byte({small ? 0x83 : 0x05}); if(small) byte({0xC0}); break;  // add eax, imm
+                case Inst::SUB: byte({small ? 0x83 : 0x2D}); if(small) byte({0xE8}); break;  // sub eax, imm
+                default: byte({small ? 0x6B : 0x69, 0xC0}); break;                           // imul eax, eax, imm
+            }
+            if(small) byte({v}); else imm32(v);
+        }
+        else
+        {
+            fetch(1, i.op[2]);
+            switch(i.inst)
+            {
+                case Inst::ADD: byte({0x01, 0xC8}); break;        // add eax, ecx
+                case Inst::SUB: byte({0x29, 0xC8}); break;        // sub eax, ecx
+                case Inst::MUL: byte({0x0F, 0xAF, 0xC1}); break;  // imul eax, ecx
+                case Inst::DIV: byte({0x99, 0xF7, 0xF9}); break;  // cdq; idiv ecx
+                default: byte({0x99, 0xF7, 0xF9, 0x89, 0xD0}); break;  // cdq; idiv ecx; mov eax, edx
+            }
+        }
+        put(i.op[0].val);
+    }
+    // add rsp, frame; pop r15-r12; ret
+    if(frame)
+    {
+        byte({0x48, 0x81, 0xC4}); imm32(frame);
+    }
+    byte({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0xC3});
+
+    long page = sysconf(_SC_PAGESIZE);
+    size = (code.size() + page - 1) / page * page;
+    buf = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(buf == MAP_FAILED) throw runtime_error("Jit: mmap failed");
+    memcpy(buf, code.data(), code.size());
+    if(mprotect(buf, size, PROT_READ | PROT_EXEC)) throw runtime_error("Jit: mprotect failed");
+    fn = (void (*)(char *))buf;
+    vector<unsigned char>().swap(code);
+}
+
+Jit::~Jit()
+{
+    if(buf != MAP_FAILED) munmap(buf, size);
+}
+
+void Jit::fetch(int x, const ASM::Operand &o)
+{
+    if(o.type == Data::VAL)
+    {
+        byte({0xB8 | x}); imm32(o.val);                       // mov e?x, imm
+    }
+    else if(o.val < NATIVE)
+        byte({0x44, 0x89, 0xC0 | o.val << 3 | x});           // mov e?x, r8d+k
+    else
+    {
+        byte({0x8B}); addr(x, true, o.val * 4);              // mov e?x, [rsp+4k]
+    }
+}
+
+void Jit::put(int r)
+{
+    if(r < NATIVE)
+        byte({0x41, 0x89, 0xC0 | r});                         // mov r8d+k, eax
+    else
+    {
+        byte({0x89}); addr(0, true, r * 4);                  // mov [rsp+4k], eax
+    }
+}
+
+void Jit::addr(int x, bool rsp, int disp)
+{
+    bool small = disp < 128;
+    byte({(small ? 0x40 : 0x80) | x << 3 | (rsp ? 0x04 : 0x07)});
+    if(rsp) byte({0x24});
+    if(small) byte({disp}); else imm32(disp);
+}
+
+tuple<int, int, int> Jit::run(const vector<int> &xyz) const
+{
+    Scratch<char, MEM::MAX + sizeof(int)> mem(mems);
+    for(int i=0; i<(int)xyz.size(); i++)
+        memcpy(mem.data + i * 4, &xyz[i], sizeof(int));
+    fn(mem.data);
+    int res[3];
+    memcpy(res, mem.data, sizeof(res));
+    return {res[0], res[1], res[2]};
+}
+#endif
+
+Batch::Batch(const vector<ASM> &list)
+{
+    footprint(list, regs, mems);
+    for(const auto &i : list)
+    {
+        if(i.inst == Inst::CE || i.inst == Inst::INVALID) break;
+        code.push_back({i.inst, i.op[1].type == Data::VAL, i.op[2].type == Data::VAL, i.op[0].val, i.op[1].val, i.op[2].val});
+    }
+}
+
+// MEM word w of lane l holds bytes [4w, 4w + 4) of that lane's image, so an
+// aligned address is one vector; any other address is assembled per lane.
+void Batch::load(const Vec *mem, int addr, Vec &res)
+{
+    if(addr % 4 == 0)
+    {
+        res = mem[addr / 4];
+        return;
+    }
+    const char *base = (const char *)mem;
+    for(int l=0; l<LANES; l++)
+    {
+        char w[4];
+        for(int k=0; k<4; k++)
+            w[k] = base[(addr + k) / 4 * sizeof(Vec) + l * 4 + (addr + k) % 4];
+        memcpy((char *)&res + l * 4, w, 4);
+    }
+}
+
+void Batch::store(Vec *mem, int addr, const Vec &v)
+{
+    if(addr % 4 == 0)
+    {
+        mem[addr / 4] = v;
+        return;
+    }
+    char *base = (char *)mem;
+    for(int l=0; l<LANES; l++)
+        for(int k=0; k<4; k++)
+            base[(addr + k) / 4 * sizeof(Vec) + l * 4 + (addr + k) % 4] = ((const char *)&v)[l * 4 + k];
+}
+
+void Batch::run(const int (*xyz)[3], int n, int (*out)[3], bool *trap) const
+{
+    // Only the registers and words the program names need to start out cleared.
+    Scratch<Vec, REG::MAX> reg_space(regs);
+    Scratch<Vec, (MEM::MAX + sizeof(int)) / 4 + 1> mem_space((mems + 3) / 4 + 1);
+    Vec *reg = reg_space.data, *mem = mem_space.data;
+    Vec bad = {};
+    for(int l=0; l<n; l++)
+        for(int k=0; k<3; k++)
+            mem[k][l] = xyz[l][k];
+    for(const auto &i : code)
+    {
+        Vec x, y;
+        switch(i.inst)
+        {
+            case Inst::LOAD:
+                load(mem, i.a, reg[i.d]);
+                continue;
+            case Inst::STORE:
+                store(mem, i.d, reg[i.a]);
+                continue;
+            default:
+                break;
+        }
+        x = i.imm1 ? Vec{} + i.a : reg[i.a];
+        y = i.imm2 ? Vec{} + i.b : reg[i.b];
+        switch(i.inst)
+        {
+            case Inst::ADD:
+                reg[i.d] = (Vec)((UVec)x + (UVec)y);
+                break;
+            case Inst::SUB:
+                reg[i.d] = (Vec)((UVec)x - (UVec)y);
+                break;
+            case Inst::MUL:
+                reg[i.d] = (Vec)((UVec)x * (UVec)y);
+                break;
+            default:
+            {
+                Vec fault = (y == 0) | ((x == INT_MIN) & (y == -1));
+                bad |= fault;
+                y = fault ? Vec{} + 1 : y;
+                reg[i.d] = i.inst == Inst::DIV ? x / y : x % y;
+                break;
+            }
+        }
+    }
+    for(int l=0; l<n; l++)
+    {
+        for(int k=0; k<3; k++)
+            out[l][k] = mem[k][l];
+        trap[l] = bad[l] != 0;
+    }
+}
+
+// Custom = false is the default machine with its costs folded in as constants.
+template<bool Custom>
+int base_cost(Inst inst, const Model &m)
+{
+    if(Custom) return inst < Inst::CE ? m.cost[(int)inst] : 0;
+    switch(inst)
+    {
+        case Inst::ADD:
+        case Inst::SUB:
+            return 10;
+        case Inst::MUL:
+            return 30;
+        case Inst::DIV:
+            return 50;
+        case Inst::REM:
+            return 60;
+        case Inst::STORE:
+        case Inst::LOAD:
+            return 200;
+        default:
+            return 0;
+    }
+}
+int base_cost(Inst inst, const Model &m) { return m.custom ? base_cost<true>(inst, m) : base_cost<false>(inst, m); }
+
+// Whether the instruction touches a penalized register (r8 and above by default).
+template<bool Custom>
+bool penalized(const ASM &i, const Model &m)
+{
+    int from = Custom ? m.penalty_reg : 8;
+    for(const auto &op : i.op)
+        if(op.type == Data::REG && op.val >= from)
+            return true;
+    return false;
+}
+
+// Cycles charged for one instruction. Return -1 for a "CE" instruction.
+template<bool Custom>
+int cost(const ASM &i, const Model &m)
+{
+    if(i.inst == Inst::CE) return -1;
+    int base = base_cost<Custom>(i.inst, m);
+    return penalized<Custom>(i, m) ? base * (Custom ? m.penalty_factor : 2) : base;
+}
+int cost(const ASM &i, const Model &m) { return m.custom ? cost<true>(i, m) : cost<false>(i, m); }
+
+template<bool Custom>
+int cycle(const vector<ASM> &list, const Model &m)
+{
+    int cycle = 0;
+    for(const auto &i : list)
+    {
+        int c = cost<Custom>(i, m);
+        if(c == -1) return -1;
+        cycle += c;
+    }
+    return cycle;
+}
+
+// Return -1 if there exists a "CE" instruction.
+int cycle(const vector<ASM> &list, const Model &m) { return m.custom ? cycle<true>(list, m) : cycle<false>(list, m); }
+
+
+Program::Program(istream &in, const Model &m) : invalid(0)
+{
+    string str;
+    for(int lines = 1; getline(in, str); lines++)
+    {
+        if(!insert_ASM(code, str, m))
+        {
+            code.pop_back();
+            invalid = lines;
+            break;
+        }
+        line.resize(code.size(), lines);
+    }
+    build(m);
+}
+
+Program::Program(vector<ASM> list, vector<int> lines, const Model &m) : code(move(list)), line(move(lines)), invalid(0)
+{
+    for(size_t k=0; k<code.size(); k++)
+        if(code[k].inst == Inst::INVALID)
+        {
+            invalid = k < line.size() ? line[k] : k + 1;
+            code.resize(k);
+            break;
+        }
+    build(m);
+}
+
+void Program::build(const Model &m)
+{
+    cycles = ::cycle(code, m);
+    engine = Threaded(code, m);
+}
+
+tuple<int, int, int> Machine::run(const Program &p, int x, int y, int z)
+{
+    assert(p.engine.registers() <= (int)reg.size() && p.engine.bytes() <= (int)mem.size());
+    memset(reg.data(), 0, p.engine.registers() * sizeof(int));
+    memset(mem.data(), 0, p.engine.bytes());
+    int in[3] = {x, y, z}, out[3];
+    memcpy(mem.data(), in, sizeof(in));
+    p.engine.run(reg.data(), mem.data());
+    memcpy(out, mem.data(), sizeof(out));
+    return {out[0], out[1], out[2]};
+}
+
+int Machine::read_mem(int addr) const
+{
+    int res;
+    memcpy(&res, mem.data() + addr, sizeof(int));
+    return res;
+}
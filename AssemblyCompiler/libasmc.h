@@ -0,0 +1,489 @@
+#ifndef LIBASMC_H
+#define LIBASMC_H
+
+// libasmc: the ASMC decoder, cost model and execution engines, for use in
+// process. Decode a program once into a Program and run it with a Machine:
+//
+//     Program prog(cin);
+//     Machine m;
+//     auto [x, y, z] = m.run(prog, 1, 2, 3);
+//
+// Everything that depends on the machine takes a Model, the course machine
+// unless given; there is no global state.
+//
+// Build: g++ -O2 -pthread ASMC.cpp libasmc.cpp -o ASMC
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cassert>
+#include <climits>
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include "../asm_object.h"
+
+enum class Inst
+{
+    ADD, SUB, MUL, DIV, REM, STORE, LOAD, CE, INVALID
+};
+enum class Data
+{
+    MEM, REG, VAL, INVALID
+};
+// Machine model: register file and memory size, instruction costs and the
+// register penalty. The defaults describe the course machine. --model=FILE
+// reads "key = value" lines, and --key=value sets a single entry.
+struct Model
+{
+    const static int REGS = 256, MEMORY = 256;
+    // Register numbers must fit the u8 operand 0 of an object record.
+    const static int MAX_REGS = 256, MAX_MEMORY = 1 << 24;
+    int regs, mem;
+    int cost[(int)Inst::CE];
+    // Instructions that touch a register >= penalty_reg cost penalty_factor times as much.
+    int penalty_reg, penalty_factor;
+    // False while every entry has its default value.
+    bool custom;
+    Model() : regs(REGS), mem(MEMORY), cost{10, 10, 30, 50, 60, 200, 200}, penalty_reg(8), penalty_factor(2), custom(false) {}
+    // Return false for an unknown key or a value out of range.
+    bool set(const std::string &key, int val);
+    bool load(const char *path);
+    // The course machine, the default of every function taking a Model.
+    static const Model &standard();
+};
+
+struct ASM
+{
+    Inst inst;
+    struct Operand
+    {
+        int val;
+        Data type;
+        Operand() : val(0), type(Data::INVALID) {}
+        Operand(int t1, Data t2) : val(t1), type(t2) {}
+    } op[3];
+    ASM() : inst(Inst::INVALID) {}
+    // Single pass decoder. Accepts exactly the lines the former regexes did:
+    //   (add|sub|mul|div|rem) +r[0-9]+ +(r[0-9]+|[0-9]+) +(r[0-9]+|[0-9]+) *
+    //   load +r[0-9]+ +\[[0-9]+\] *
+    //   store +\[[0-9]+\] +r[0-9]+ *
+    ASM(const char *p, const char *end, const Model &m = Model::standard()) : ASM()
+    {
+        static const char ce[] = "Compile Error!";
+        if(end - p == (int)sizeof(ce) - 1 && !memcmp(p, ce, sizeof(ce) - 1))
+        {
+            inst = Inst::CE;
+            return;
+        }
+        Inst t = opcode(p, end);
+        if(t == Inst::INVALID || !spaces(p, end))
+            return;
+        if(t == Inst::STORE)
+        {
+            if(!address(p, end, op[0]) || !spaces(p, end) || !reg(p, end, op[1]))
+                return;
+        }
+        else
+        {
+            if(!reg(p, end, op[0]) || !spaces(p, end))
+                return;
+            if(t == Inst::LOAD)
+            {
+                if(!address(p, end, op[1]))
+                    return;
+            }
+            else if(!(reg(p, end, op[1]) || value(p, end, op[1])) || !spaces(p, end) ||
+                    !(reg(p, end, op[2]) || value(p, end, op[2])))
+                return;
+        }
+        spaces(p, end);
+        if(p != end)
+            return;
+        inst = t;
+        check(m);
+    }
+    ASM(const std::string &in, const Model &m = Model::standard()) : ASM(in.data(), in.data() + in.size(), m) {}
+    ASM(const char *in, const Model &m = Model::standard()) : ASM(in, in + strlen(in), m) {}
+    // Binary record: the fields are copied, only the ranges are checked.
+    explicit ASM(const AsmoInst &in, const Model &m = Model::standard()) : ASM()
+    {
+        static const Data kind[] = {Data::INVALID, Data::REG, Data::MEM, Data::VAL};
+        if(in.op == ASMO_CE)
+        {
+            inst = Inst::CE;
+            return;
+        }
+        if(in.op > ASMO_LOAD)
+            return;
+        int val[3] = {in.d, in.a, in.b};
+        for(int i=0; i<3; i++)
+            op[i] = Operand(val[i], kind[ASMO_KIND_OF(in.kind, i)]);
+        bool ok;
+        switch(in.op)
+        {
+            case ASMO_STORE:
+                ok = op[0].type == Data::MEM && op[1].type == Data::REG && op[2].type == Data::INVALID;
+                break;
+            case ASMO_LOAD:
+                ok = op[0].type == Data::REG && op[1].type == Data::MEM && op[2].type == Data::INVALID;
+                break;
+            default:
+                ok = op[0].type == Data::REG;
+                for(int i=1; i<3; i++)
+                    ok = ok && (op[i].type == Data::REG || op[i].type == Data::VAL);
+                break;
+        }
+        if(!ok) return;
+        inst = (Inst)in.op;
+        check(m);
+    }
+    // Only for operand 0 below 256, the widest the object format holds.
+    AsmoInst record() const
+    {
+        static const AsmoKind kind[] = {ASMO_MEM, ASMO_REG, ASMO_VAL, ASMO_NONE};
+        AsmoInst rec = {(uint8_t)inst, 0, (uint8_t)op[0].val, 0, op[1].val, op[2].val};
+        rec.kind = ASMO_KIND(kind[(int)op[0].type], kind[(int)op[1].type], kind[(int)op[2].type]);
+        return rec;
+    }
+    // Text syntax of this instruction, as the compilers print it.
+    std::string str() const
+    {
+        if(inst == Inst::CE) return "Compile Error!";
+        if(inst == Inst::INVALID) return "?";
+        std::string res = asmo_name[(int)inst];
+        for(const auto &o : op)
+            switch(o.type)
+            {
+                case Data::REG: res += " r" + std::to_string(o.val); break;
+                case Data::MEM: res += " [" + std::to_string(o.val) + "]"; break;
+                case Data::VAL: res += " " + std::to_string(o.val); break;
+                default: break;
+            }
+        return res;
+    }
+
+private:
+    void check(const Model &m)
+    {
+        for(const auto &o : op)
+        {
+            if(o.type == Data::REG && (o.val >= m.regs || o.val < 0)) inst = Inst::INVALID;
+            if(o.type == Data::MEM && (o.val >= m.mem || o.val < 0)) inst = Inst::INVALID;
+            if(o.type == Data::VAL && o.val < 0) inst = Inst::INVALID;
+        }
+    }
+    static Inst opcode(const char *&p, const char *end)
+    {
+        static const struct { const char *name; int len; Inst inst; } table[] = {
+            {"add", 3, Inst::ADD}, {"sub", 3, Inst::SUB}, {"mul", 3, Inst::MUL},
+            {"div", 3, Inst::DIV}, {"rem", 3, Inst::REM},
+            {"load", 4, Inst::LOAD}, {"store", 5, Inst::STORE}
+        };
+        for(const auto &i : table)
+            if(end - p >= i.len && !memcmp(p, i.name, i.len))
+            {
+                p += i.len;
+                return i.inst;
+            }
+        return Inst::INVALID;
+    }
+    // Skip " +", return false if there is no space at all.
+    static bool spaces(const char *&p, const char *end)
+    {
+        const char *s = p;
+        while(p < end && *p == ' ') p++;
+        return p != s;
+    }
+    // Read [0-9]+ into an int the same way sscanf("%d") stores it:
+    // the digits saturate at LONG_MAX and the long is then truncated to int.
+    static bool number(const char *&p, const char *end, int &res)
+    {
+        const char *s = p;
+        unsigned long acc = 0;
+        for(; p < end && '0' <= *p && *p <= '9'; p++)
+        {
+            unsigned long d = *p - '0';
+            acc = acc > (LONG_MAX - d) / 10 ? LONG_MAX : acc * 10 + d;
+        }
+        res = (int)(long)acc;
+        return p != s;
+    }
+    static bool reg(const char *&p, const char *end, Operand &o)
+    {
+        if(p == end || *p != 'r')
+            return false;
+        const char *s = p++;
+        if(!number(p, end, o.val))
+        {
+            p = s;
+            return false;
+        }
+        o.type = Data::REG;
+        return true;
+    }
+    static bool value(const char *&p, const char *end, Operand &o)
+    {
+        if(!number(p, end, o.val))
+            return false;
+        o.type = Data::VAL;
+        return true;
+    }
+    static bool address(const char *&p, const char *end, Operand &o)
+    {
+        if(p == end || *p != '[')
+            return false;
+        p++;
+        if(!number(p, end, o.val) || p == end || *p != ']')
+            return false;
+        p++;
+        o.type = Data::MEM;
+        return true;
+    }
+};
+// Sized by the machine model. MAX is the size on the default machine.
+struct REG
+{
+    const static int MAX = Model::REGS;
+    std::vector<int> val;
+    explicit REG(const Model &m = Model::standard()) : val(m.regs) {}
+    int rw(int idx)
+    {
+        assert(0 <= idx && idx < (int)val.size());
+        return val[idx];
+    }
+    void sw(int idx, int d)
+    {
+        assert(0 <= idx && idx < (int)val.size());
+        val[idx] = d;
+    }
+    void clear() { std::fill(val.begin(), val.end(), 0); }
+};
+struct MEM
+{
+    const static int MAX = Model::MEMORY;
+    // Padded so a word access at the last address stays in bounds.
+    std::vector<char> val;
+    explicit MEM(const Model &m = Model::standard()) : val(m.mem + sizeof(int)) {}
+    int size() const { return (int)val.size() - (int)sizeof(int); }
+    int rw(int idx)
+    {
+        assert(0 <= idx && idx < size());
+        int res;
+        memcpy(&res, val.data() + idx, sizeof(int));
+        return res;
+    }
+    void sw(int idx, int d)
+    {
+        assert(0 <= idx && idx < size());
+        memcpy(val.data() + idx, &d, sizeof(int));
+    }
+};
+
+// Zeroed scratch space for an engine run: on the stack up to N elements, on
+// the heap for a machine model larger than that.
+template<class T, int N>
+struct Scratch
+{
+    T local[N];
+    std::vector<T> heap;
+    T *data;
+    explicit Scratch(size_t n) : data(local)
+    {
+        if(n > N)
+        {
+            heap.resize(n);
+            data = heap.data();
+        }
+        memset((void *)data, 0, n * sizeof(T));
+    }
+};
+
+// Register count and memory bytes (padded for the last word) that a program
+// touches, never less than the x, y, z image.
+void footprint(const std::vector<ASM> &list, int &regs, int &mems);
+
+// Return false if the ASM is invalid.
+bool insert_ASM(std::vector<ASM> &list, const std::string &in, const Model &m = Model::standard());
+
+// Execute one instruction. Return false if it is a "CE" instruction.
+bool execute(const ASM &i, REG &reg, MEM &mem);
+
+// Return -1 if there exists a "CE" instruction.
+std::tuple<int, int, int> evaluate(const std::vector<ASM> &list, const std::vector<int> &xyz = std::vector<int>(),
+                                   const Model &m = Model::standard());
+
+// Cycles charged for an instruction before the register penalty, 0 if invalid.
+int base_cost(Inst inst, const Model &m = Model::standard());
+
+// Cycles charged for one instruction. Return -1 for a "CE" instruction.
+int cost(const ASM &i, const Model &m = Model::standard());
+
+// Return -1 if there exists a "CE" instruction.
+int cycle(const std::vector<ASM> &list, const Model &m = Model::standard());
+
+// Pre-decoded execution engine. The list is lowered once into handlers
+// specialized on opcode and operand kinds, and run with direct threading.
+// Runs of two or more add/sub/mul become one handler that evaluates them
+// without branches, so straight-line arithmetic pays no dispatch per
+// instruction. Operand ranges are checked while lowering, so handlers index
+// REG/MEM freely.
+class Threaded
+{
+public:
+    Threaded() : Threaded(std::vector<ASM>()) {}
+    explicit Threaded(const std::vector<ASM> &list, const Model &m = Model::standard());
+    // Same result as evaluate(list, xyz).
+    std::tuple<int, int, int> run(const std::vector<int> &xyz = std::vector<int>()) const;
+    // Run on caller-owned state. reg needs registers() entries and mem bytes()
+    // bytes, zeroed except for the input image.
+    void run(int *reg, char *mem) const { exec(code.data(), alu.data(), reg, mem); }
+    int registers() const { return regs; }
+    int bytes() const { return mems; }
+
+private:
+    enum Handler
+    {
+        ADD_RR, ADD_RI, ADD_IR, ADD_II,
+        SUB_RR, SUB_RI, SUB_IR, SUB_II,
+        MUL_RR, MUL_RI, MUL_IR, MUL_II,
+        DIV_RR, DIV_RI, DIV_IR, DIV_II,
+        REM_RR, REM_RI, REM_IR, REM_II,
+        LOAD, STORE, HALT, BLOCK
+    };
+    struct Op
+    {
+        const void *go;
+        int d, a, b;
+    };
+    // One add/sub/mul of a block, packed to keep long blocks cache friendly.
+    // ra through mul are masks, 0 or -1. An operand reads
+    // (reg[a] & ra) | (imm & ia), so at most one of them is an immediate; an
+    // op on two immediates is folded into imm. neg negates b (sub) and mul
+    // selects the product.
+    struct Alu
+    {
+        uint16_t d, a, b;
+        int8_t ra, ia, rb, ib, neg, mul;
+        int imm;
+    };
+    std::vector<Op> code;
+    std::vector<Alu> alu;
+    int regs, mems;
+    // Execute from pc. With pc == nullptr, return the handler table instead.
+    static const void *const *exec(const Op *pc, const Alu *alu, int *reg, char *mem);
+};
+
+#if defined(__x86_64__)
+// Native backend. The list is translated once into x86-64 code in an
+// mmap'd buffer. r0-r7 live in r8d-r15d, the other registers in a stack
+// frame sized to the highest register used, and MEM is the image passed
+// in rdi.
+class Jit
+{
+public:
+    explicit Jit(const std::vector<ASM> &list, const Model &m = Model::standard());
+    ~Jit();
+    Jit(const Jit &) = delete;
+    Jit &operator=(const Jit &) = delete;
+    // Same result as evaluate(list, xyz).
+    std::tuple<int, int, int> run(const std::vector<int> &xyz = std::vector<int>()) const;
+    // Same result as cycle(list, m).
+    int cycle() const { return cost; }
+
+private:
+    const static int NATIVE = 8;
+    std::vector<unsigned char> code;
+    int frame, mems;
+    void *buf;
+    size_t size;
+    int cost;
+    void (*fn)(char *mem);
+
+    void byte(std::initializer_list<int> b) { for(int i : b) code.push_back(i); }
+    void imm32(int v) { for(int i=0; i<4; i++) code.push_back((unsigned)v >> (i * 8)); }
+    // Move operand o into eax (x = 0) or ecx (x = 1).
+    void fetch(int x, const ASM::Operand &o);
+    // Move eax into register r.
+    void put(int r);
+    // ModRM (and SIB) for [base+disp] with register field x; base is rsp or rdi.
+    void addr(int x, bool rsp, int disp);
+};
+#endif
+
+// Lane-parallel engine: runs one program over LANES input triples at once.
+// Every REG slot and every MEM word is a vector with one lane per triple, so
+// add/sub/mul are single vector ops. div/rem fall back to per-lane division;
+// a lane whose divisor is zero (or that computes INT_MIN / -1) is marked as
+// trapped instead of killing the whole batch.
+class Batch
+{
+public:
+    const static int LANES = 8;
+    explicit Batch(const std::vector<ASM> &list);
+    // Evaluate n <= LANES triples. trap[i] tells whether lane i faulted.
+    void run(const int (*xyz)[3], int n, int (*out)[3], bool *trap) const;
+
+private:
+    typedef int Vec __attribute__((vector_size(LANES * sizeof(int))));
+    typedef unsigned UVec __attribute__((vector_size(LANES * sizeof(int))));
+    struct Op
+    {
+        Inst inst;
+        bool imm1, imm2;
+        int d, a, b;
+    };
+    std::vector<Op> code;
+    int regs, mems;
+    static void load(const Vec *mem, int addr, Vec &res);
+    static void store(Vec *mem, int addr, const Vec &v);
+};
+
+// A program decoded once for machine model m. Its engine code and cycle count
+// are built up front, so running it costs nothing but execution.
+class Program
+{
+public:
+    Program() : invalid(0), cycles(0) {}
+    // Decode text ASM, one instruction per line. Stops at the first invalid
+    // instruction and reports its line through bad().
+    explicit Program(std::istream &in, const Model &m = Model::standard());
+    explicit Program(std::vector<ASM> list, std::vector<int> lines = std::vector<int>(),
+                     const Model &m = Model::standard());
+    // Line of the first invalid instruction, 0 if there is none.
+    int bad() const { return invalid; }
+    // Same as cycle(list()): -1 if there is a "CE" instruction.
+    int cycle() const { return cycles; }
+    const std::vector<ASM> &list() const { return code; }
+    // Source line of each entry of list().
+    const std::vector<int> &lines() const { return line; }
+
+private:
+    friend class Machine;
+    std::vector<ASM> code;
+    std::vector<int> line;
+    int invalid, cycles;
+    Threaded engine;
+    void build(const Model &m);
+};
+
+// Register file and memory of machine model m, allocated once. A run
+// clears only the registers and bytes the program touches, so running a
+// program millions of times allocates nothing. A division by zero traps as
+// it does in ASMC.
+class Machine
+{
+public:
+    explicit Machine(const Model &m = Model::standard()) : reg(m.regs), mem(m.mem + sizeof(int)) {}
+    // Same result as evaluate(p.list(), {x, y, z}, m), for p decoded with m.
+    std::tuple<int, int, int> run(const Program &p, int x, int y, int z);
+    // State left by the last run.
+    int read_reg(int idx) const { return reg[idx]; }
+    int read_mem(int addr) const;
+
+private:
+    std::vector<int> reg;
+    std::vector<char> mem;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef ASM_OBJECT_H
+#define ASM_OBJECT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+   Binary ASM object format, shared by the compilers (-b) and ASMC (--object).
+   A 16-byte header is followed by one fixed 12-byte record per instruction in
+   program order. There is no instruction count, so a compiler can stream the
+   records; a reader takes (size - 16) / 12 of them and rejects an image
+   that ends inside a record.
+
+   record: op (u8), kind (u8, 2 bits per operand), d (u8), pad (u8), a (i32), b (i32)
+
+   d holds operand 0 (a register, or the address of store), a and b hold
+   operands 1 and 2 (a register, an address or an immediate, as kind says).
+   All fields are in host byte order.
+ */
+
+#define ASMO_MAGIC "ASMO"
+#define ASMO_VERSION 1
+
+// Same order as Inst in ASMC.
+typedef enum {
+	ASMO_ADD, ASMO_SUB, ASMO_MUL, ASMO_DIV, ASMO_REM, ASMO_STORE, ASMO_LOAD, ASMO_CE, ASMO_INVALID = 0xFF
+} AsmoOp;
+
+typedef enum {
+	ASMO_NONE, ASMO_REG, ASMO_MEM, ASMO_VAL
+} AsmoKind;
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t reserved[2];
+} AsmoHeader;
+
+typedef struct {
+	uint8_t op;
+	uint8_t kind;
+	uint8_t d;
+	uint8_t pad;
+	int32_t a, b;
+} AsmoInst;
+
+#define ASMO_KIND(k0, k1, k2) ((k0) | (k1) << 2 | (k2) << 4)
+#define ASMO_KIND_OF(kind, i) ((AsmoKind)((kind) >> ((i) * 2) & 3))
+
+static const char *const asmo_name[] = {"add", "sub", "mul", "div", "rem", "store", "load"};
+
+// Write the object header.
+static inline void asmo_write_header(FILE *out)
+{
+	AsmoHeader h = {{'A', 'S', 'M', 'O'}, ASMO_VERSION, {0, 0}};
+	fwrite(&h, sizeof(h), 1, out);
+}
+
+// Return 1 if h is a header this reader understands.
+static inline int asmo_check_header(const AsmoHeader *h)
+{
+	return !memcmp(h->magic, ASMO_MAGIC, 4) && h->version == ASMO_VERSION;
+}
+
+#endif
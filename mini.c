@@ -2,6 +2,7 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include "asm_object.h"
 
 /*
    For the language grammar, please refer to Grammar section on the github page:
@@ -37,7 +38,7 @@ typedef struct ASTUnit {
 // err marco should be used when a expression error occurs.
 #define err(x)\
 {\
-	puts("Compile Error!");\
+	emit(ASMO_CE, NONE, NONE, NONE);\
 	if(DEBUG) {\
 		fprintf(stderr, "Error at line: %d\n", __LINE__);\
 		fprintf(stderr, "Error message: %s\n", x);\
@@ -111,6 +112,15 @@ void token_print(Token *in, size_t len);
 // Print AST tree.
 void AST_print(AST *head);
 
+// Operands of emit(): a register, a memory address, an immediate, or none.
+#define R(x) ASMO_REG, (x)
+#define M(x) ASMO_MEM, (x)
+#define V(x) ASMO_VAL, (x)
+#define NONE ASMO_NONE, 0
+
+// Print one instruction line, or its binary record with "-b".
+void emit(AsmoOp op, AsmoKind kd, int d, AsmoKind ka, int a, AsmoKind kb, int b);
+
 char input[MAX_LENGTH];
 
 int reg_table[MAX_REG];
@@ -119,8 +129,14 @@ int var_alter[3];
 
 int var_reg_ref[3] = {-1, -1, -1};
 
-int main() 
+int binary_output = 0;
+
+int main(int argc, char **argv) 
 {
+	if (argc > 1 && !strcmp(argv[1], "-b")) {
+		binary_output = 1;
+		asmo_write_header(stdout);
+	}
 	while (fgets(input, MAX_LENGTH, stdin) != NULL) {
 		Token *content = lexer(input);
 		size_t len = token_list_to_arr(&content);
@@ -442,15 +458,15 @@ int codegen(AST *root)
 				tmp = tmp->mid;
 			reg = codegen(root->rhs);
 			if (tmp->val == 'x') {
-				printf("store [0] r%d\n", reg);
+				emit(ASMO_STORE, M(0), R(reg), NONE);
 				var_reg_ref[0] = -1;
 			}
 			else if (tmp->val == 'y') {
-				printf("store [4] r%d\n", reg);
+				emit(ASMO_STORE, M(4), R(reg), NONE);
 				var_reg_ref[1] = -1;
 			}
 			else {
-				printf("store [8] r%d\n", reg);
+				emit(ASMO_STORE, M(8), R(reg), NONE);
 				var_reg_ref[2] = -1;
 			}
 			return reg;
@@ -460,7 +476,7 @@ int codegen(AST *root)
 				reg1 = codegen(root->lhs);
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("add r%d r%d r%d\n", reg, reg1, reg2);
+				emit(ASMO_ADD, R(reg), R(reg1), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -478,7 +494,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("add r%d %d r%d\n", reg, root->lhs->val, reg2);
+				emit(ASMO_ADD, R(reg), V(root->lhs->val), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg2 == var_reg_ref[i])
 						break;
@@ -489,7 +505,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
 				reg1 = codegen(root->lhs);
 				reg = newReg();
-				printf("add r%d r%d %d\n", reg, reg1, root->rhs->val);
+				emit(ASMO_ADD, R(reg), R(reg1), V(root->rhs->val));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -499,7 +515,7 @@ int codegen(AST *root)
 			}
 			else {
 				reg = newReg();
-				printf("add r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
+				emit(ASMO_ADD, R(reg), V(root->lhs->val), V(root->rhs->val));
 			}
 			return reg;
 
@@ -508,7 +524,7 @@ int codegen(AST *root)
 				reg1 = codegen(root->lhs);
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("sub r%d r%d r%d\n", reg, reg1, reg2);
+				emit(ASMO_SUB, R(reg), R(reg1), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -525,7 +541,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("sub r%d %d r%d\n", reg, root->lhs->val, reg2);
+				emit(ASMO_SUB, R(reg), V(root->lhs->val), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg2 == var_reg_ref[i])
 						break;
@@ -536,7 +552,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
 				reg1 = codegen(root->lhs);
 				reg = newReg();
-				printf("sub r%d r%d %d\n", reg, reg1, root->rhs->val);
+				emit(ASMO_SUB, R(reg), R(reg1), V(root->rhs->val));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -546,7 +562,7 @@ int codegen(AST *root)
 			}
 			else {
 				reg = newReg();
-				printf("sub r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
+				emit(ASMO_SUB, R(reg), V(root->lhs->val), V(root->rhs->val));
 			}
 			return reg;
 
@@ -555,7 +571,7 @@ int codegen(AST *root)
 				reg1 = codegen(root->lhs);
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("mul r%d r%d r%d\n", reg, reg1, reg2);
+				emit(ASMO_MUL, R(reg), R(reg1), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -572,7 +588,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("mul r%d %d r%d\n", reg, root->lhs->val, reg2);
+				emit(ASMO_MUL, R(reg), V(root->lhs->val), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg2 == var_reg_ref[i])
 						break;
@@ -583,7 +599,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
 				reg1 = codegen(root->lhs);
 				reg = newReg();
-				printf("mul r%d r%d %d\n", reg, reg1, root->rhs->val);
+				emit(ASMO_MUL, R(reg), R(reg1), V(root->rhs->val));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -593,7 +609,7 @@ int codegen(AST *root)
 			}
 			else {
 				reg = newReg();
-				printf("mul r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
+				emit(ASMO_MUL, R(reg), V(root->lhs->val), V(root->rhs->val));
 			}
 			return reg;
 
@@ -602,7 +618,7 @@ int codegen(AST *root)
 				reg1 = codegen(root->lhs);
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("div r%d r%d r%d\n", reg, reg1, reg2);
+				emit(ASMO_DIV, R(reg), R(reg1), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -619,7 +635,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("div r%d %d r%d\n", reg, root->lhs->val, reg2);
+				emit(ASMO_DIV, R(reg), V(root->lhs->val), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg2 == var_reg_ref[i])
 						break;
@@ -630,7 +646,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
 				reg1 = codegen(root->lhs);
 				reg = newReg();
-				printf("div r%d r%d %d\n", reg, reg1, root->rhs->val);
+				emit(ASMO_DIV, R(reg), R(reg1), V(root->rhs->val));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -640,7 +656,7 @@ int codegen(AST *root)
 			}
 			else {
 				reg = newReg();
-				printf("div r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
+				emit(ASMO_DIV, R(reg), V(root->lhs->val), V(root->rhs->val));
 			}
 			return reg;
 
@@ -649,7 +665,7 @@ int codegen(AST *root)
 				reg1 = codegen(root->lhs);
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("rem r%d r%d r%d\n", reg, reg1, reg2);
+				emit(ASMO_REM, R(reg), R(reg1), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -666,7 +682,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("rem r%d %d r%d\n", reg, root->lhs->val, reg2);
+				emit(ASMO_REM, R(reg), V(root->lhs->val), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg2 == var_reg_ref[i])
 						break;
@@ -677,7 +693,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
 				reg1 = codegen(root->lhs);
 				reg = newReg();
-				printf("rem r%d r%d %d\n", reg, reg1, root->rhs->val);
+				emit(ASMO_REM, R(reg), R(reg1), V(root->rhs->val));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -687,16 +703,16 @@ int codegen(AST *root)
 			}
 			else {
 				reg = newReg();
-				printf("rem r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
+				emit(ASMO_REM, R(reg), V(root->lhs->val), V(root->rhs->val));
 			}
 			return reg;
 
 		case PREINC:
 			reg = codegen(root->mid);
-			printf("add r%d r%d 1\n", reg, reg);
+			emit(ASMO_ADD, R(reg), R(reg), V(1));
 			for (i = 0; i < 3; i++) {
 				if (reg == var_reg_ref[i]) {
-					printf("store [%d] r%d\n", 4 * i, reg);
+					emit(ASMO_STORE, M(4 * i), R(reg), NONE);
 					break;
 				}
 			}
@@ -710,16 +726,16 @@ int codegen(AST *root)
 					i = 4;
 				else
 					i = 8;
-				printf("store [%d] r%d\n", i, reg);
+				emit(ASMO_STORE, M(i), R(reg), NONE);
 			}
 			return reg;
 
 		case PREDEC:
 			reg = codegen(root->mid);
-			printf("sub r%d r%d 1\n", reg, reg);
+			emit(ASMO_SUB, R(reg), R(reg), V(1));
 			for (i = 0; i < 3; i++) {
 				if (reg == var_reg_ref[i]) {
-					printf("store [%d] r%d\n", 4 * i, reg);
+					emit(ASMO_STORE, M(4 * i), R(reg), NONE);
 					break;
 				}
 			}
@@ -733,7 +749,7 @@ int codegen(AST *root)
 					i = 4;
 				else
 					i = 8;
-				printf("store [%d] r%d\n", i, reg);
+				emit(ASMO_STORE, M(i), R(reg), NONE);
 			}
 			return reg;
 
@@ -765,7 +781,7 @@ int codegen(AST *root)
 			if (root->val == 'x') {
 				if (var_reg_ref[0] < 0) {
 					reg = newReg();
-					printf("load r%d [0]\n", reg);
+					emit(ASMO_LOAD, R(reg), M(0), NONE);
 					var_reg_ref[0] = reg;
 				}
 				else
@@ -774,7 +790,7 @@ int codegen(AST *root)
 			else if (root->val == 'y') {
 				if (var_reg_ref[1] < 0) {
 					reg = newReg();
-					printf("load r%d [4]\n", reg);
+					emit(ASMO_LOAD, R(reg), M(4), NONE);
 					var_reg_ref[1] = reg;
 				}
 				else
@@ -783,7 +799,7 @@ int codegen(AST *root)
 			else {
 				if (var_reg_ref[2] < 0) {
 					reg = newReg();
-					printf("load r%d [8]\n", reg);
+					emit(ASMO_LOAD, R(reg), M(8), NONE);
 					var_reg_ref[2] = reg;
 				}
 				else
@@ -793,7 +809,7 @@ int codegen(AST *root)
 
 		case CONSTANT:
 			reg = newReg();
-			printf("add r%d r%d %d\n", reg, reg, root->val);
+			emit(ASMO_ADD, R(reg), R(reg), V(root->val));
 			return reg;
 
 		case LPAR:
@@ -809,7 +825,7 @@ int codegen(AST *root)
 		case MINUS:
 			reg2 = codegen(root->mid);
 			reg1 = newReg();
-			printf("sub r%d 0 r%d\n", reg1, reg2);
+			emit(ASMO_SUB, R(reg1), V(0), R(reg2));
 			return reg1;
 
 		default: ;
@@ -836,7 +852,7 @@ int newReg()
 void freeReg(int reg)
 {
 	reg_table[reg] = 0;
-	printf("sub r%d r%d r%d\n", reg, reg, reg);
+	emit(ASMO_SUB, R(reg), R(reg), R(reg));
 
 	return ;
 }
@@ -850,15 +866,15 @@ void postIncDec()
 		if (var_alter[i] != 0) {
 			if (var_reg_ref[i] < 0) {
 				reg = newReg();
-				printf("load r%d [%d]\n", reg, i * 4);
+				emit(ASMO_LOAD, R(reg), M(i * 4), NONE);
 			}
 			else
 				reg = var_reg_ref[i];
 			if (var_alter[i] > 0)
-				printf("add r%d r%d %d\n", reg, reg, var_alter[i]);
+				emit(ASMO_ADD, R(reg), R(reg), V(var_alter[i]));
 			else
-				printf("sub r%d r%d %d\n", reg, reg, var_alter[i] * -1);
-			printf("store [%d] r%d\n", i * 4, reg);
+				emit(ASMO_SUB, R(reg), R(reg), V(var_alter[i] * -1));
+			emit(ASMO_STORE, M(i * 4), R(reg), NONE);
 			var_reg_ref[i] = -1;
 			var_alter[i] = 0;
 		}
@@ -868,6 +884,30 @@ void postIncDec()
 }
 //*/
 
+// Print one instruction line, or its binary record with "-b".
+void emit(AsmoOp op, AsmoKind kd, int d, AsmoKind ka, int a, AsmoKind kb, int b)
+{
+	AsmoKind kind[3] = {kd, ka, kb};
+	int val[3] = {d, a, b};
+	AsmoInst rec = {op, ASMO_KIND(kd, ka, kb), (uint8_t)d, 0, a, b};
+
+	if (binary_output) {
+		// Operand 0 is a byte; a record that cannot hold it is rejected by the reader.
+		if (op != ASMO_CE && (d < 0 || d > 0xFF))
+			rec.op = ASMO_INVALID;
+		fwrite(&rec, sizeof(rec), 1, stdout);
+		return ;
+	}
+	if (op == ASMO_CE) {
+		puts("Compile Error!");
+		return ;
+	}
+	fputs(asmo_name[op], stdout);
+	for (int i = 0; i < 3 && kind[i] != ASMO_NONE; i++)
+		printf(kind[i] == ASMO_REG ? " r%d" : kind[i] == ASMO_MEM ? " [%d]" : " %d", val[i]);
+	putchar('\n');
+}
+
 // Free the whole AST.
 void freeAST(AST *now) 
 {
@@ -2,6 +2,7 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include "asm_object.h"
 
 /*
    For the language grammar, please refer to Grammar section on the github page:
@@ -37,7 +38,7 @@ typedef struct ASTUnit {
 // err marco should be used when a expression error occurs.
 #define err(x)\
 {\
-	puts("Compile Error!");\
+	emit(ASMO_CE, NONE, NONE, NONE);\
 	if(DEBUG) {\
 		fprintf(stderr, "Error at line: %d\n", __LINE__);\
 		fprintf(stderr, "Error message: %s\n", x);\
@@ -119,6 +120,15 @@ void token_print(Token *in, size_t len);
 // Print AST tree.
 void AST_print(AST *head);
 
+// Operands of emit(): a register, a memory address, an immediate, or none.
+#define R(x) ASMO_REG, (x)
+#define M(x) ASMO_MEM, (x)
+#define V(x) ASMO_VAL, (x)
+#define NONE ASMO_NONE, 0
+
+// Print one instruction line, or its binary record with "-b".
+void emit(AsmoOp op, AsmoKind kd, int d, AsmoKind ka, int a, AsmoKind kb, int b);
+
 char input[MAX_LENGTH];
 
 int reg_table[MAX_REG];
@@ -127,8 +137,14 @@ int var_alter[3];
 
 int var_reg_ref[3] = {-1, -1, -1};
 
-int main() 
+int binary_output = 0;
+
+int main(int argc, char **argv) 
 {
+	if (argc > 1 && !strcmp(argv[1], "-b")) {
+		binary_output = 1;
+		asmo_write_header(stdout);
+	}
 	while (fgets(input, MAX_LENGTH, stdin) != NULL) {
 		Token *content = lexer(input);
 		size_t len = token_list_to_arr(&content);
@@ -456,33 +472,33 @@ int codegen(AST *root)
 			if (tmp->val == 'x') {
 				if (var_reg_ref[0] >= 0) {
 					reg = var_reg_ref[0];
-					printf("add r%d r%d 0\n", var_reg_ref[0], reg1);
+					emit(ASMO_ADD, R(var_reg_ref[0]), R(reg1), V(0));
 				}
 				else {
 					reg = newReg();
-					printf("add r%d r%d 0\n", reg, reg1);
+					emit(ASMO_ADD, R(reg), R(reg1), V(0));
 					var_reg_ref[0] = reg;
 				}
 			}
 			else if (tmp->val == 'y') {
 				if (var_reg_ref[1] >= 0) {
 					reg = var_reg_ref[1];
-					printf("add r%d r%d 0\n", var_reg_ref[1], reg1);
+					emit(ASMO_ADD, R(var_reg_ref[1]), R(reg1), V(0));
 				}		
 				else {
 					reg = newReg();
-					printf("add r%d r%d 0\n", reg, reg1);
+					emit(ASMO_ADD, R(reg), R(reg1), V(0));
 					var_reg_ref[1] = reg;
 				}
 			}
 			else {
 				if (var_reg_ref[2] >= 0) {
 					reg = var_reg_ref[2];
-					printf("add r%d r%d 0\n", var_reg_ref[2], reg1);
+					emit(ASMO_ADD, R(var_reg_ref[2]), R(reg1), V(0));
 				}
 				else {
 					reg = newReg();
-					printf("add r%d r%d 0\n", reg, reg1);
+					emit(ASMO_ADD, R(reg), R(reg1), V(0));
 					var_reg_ref[2] = reg;
 				}
 			}
@@ -493,7 +509,7 @@ int codegen(AST *root)
 				reg1 = codegen(root->lhs);
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("add r%d r%d r%d\n", reg, reg1, reg2);
+				emit(ASMO_ADD, R(reg), R(reg1), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -511,7 +527,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("add r%d %d r%d\n", reg, root->lhs->val, reg2);
+				emit(ASMO_ADD, R(reg), V(root->lhs->val), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg2 == var_reg_ref[i])
 						break;
@@ -522,7 +538,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
 				reg1 = codegen(root->lhs);
 				reg = newReg();
-				printf("add r%d r%d %d\n", reg, reg1, root->rhs->val);
+				emit(ASMO_ADD, R(reg), R(reg1), V(root->rhs->val));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -532,7 +548,7 @@ int codegen(AST *root)
 			}
 			else {
 				reg = newReg();
-				printf("add r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
+				emit(ASMO_ADD, R(reg), V(root->lhs->val), V(root->rhs->val));
 			}
 			return reg;
 
@@ -541,7 +557,7 @@ int codegen(AST *root)
 				reg1 = codegen(root->lhs);
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("sub r%d r%d r%d\n", reg, reg1, reg2);
+				emit(ASMO_SUB, R(reg), R(reg1), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -558,7 +574,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("sub r%d %d r%d\n", reg, root->lhs->val, reg2);
+				emit(ASMO_SUB, R(reg), V(root->lhs->val), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg2 == var_reg_ref[i])
 						break;
@@ -569,7 +585,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
 				reg1 = codegen(root->lhs);
 				reg = newReg();
-				printf("sub r%d r%d %d\n", reg, reg1, root->rhs->val);
+				emit(ASMO_SUB, R(reg), R(reg1), V(root->rhs->val));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -579,7 +595,7 @@ int codegen(AST *root)
 			}
 			else {
 				reg = newReg();
-				printf("sub r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
+				emit(ASMO_SUB, R(reg), V(root->lhs->val), V(root->rhs->val));
 			}
 			return reg;
 
@@ -588,7 +604,7 @@ int codegen(AST *root)
 				reg1 = codegen(root->lhs);
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("mul r%d r%d r%d\n", reg, reg1, reg2);
+				emit(ASMO_MUL, R(reg), R(reg1), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -605,7 +621,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("mul r%d %d r%d\n", reg, root->lhs->val, reg2);
+				emit(ASMO_MUL, R(reg), V(root->lhs->val), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg2 == var_reg_ref[i])
 						break;
@@ -616,7 +632,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
 				reg1 = codegen(root->lhs);
 				reg = newReg();
-				printf("mul r%d r%d %d\n", reg, reg1, root->rhs->val);
+				emit(ASMO_MUL, R(reg), R(reg1), V(root->rhs->val));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -626,7 +642,7 @@ int codegen(AST *root)
 			}
 			else {
 				reg = newReg();
-				printf("mul r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
+				emit(ASMO_MUL, R(reg), V(root->lhs->val), V(root->rhs->val));
 			}
 			return reg;
 
@@ -635,7 +651,7 @@ int codegen(AST *root)
 				reg1 = codegen(root->lhs);
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("div r%d r%d r%d\n", reg, reg1, reg2);
+				emit(ASMO_DIV, R(reg), R(reg1), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -652,7 +668,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("div r%d %d r%d\n", reg, root->lhs->val, reg2);
+				emit(ASMO_DIV, R(reg), V(root->lhs->val), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg2 == var_reg_ref[i])
 						break;
@@ -663,7 +679,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
 				reg1 = codegen(root->lhs);
 				reg = newReg();
-				printf("div r%d r%d %d\n", reg, reg1, root->rhs->val);
+				emit(ASMO_DIV, R(reg), R(reg1), V(root->rhs->val));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -673,7 +689,7 @@ int codegen(AST *root)
 			}
 			else {
 				reg = newReg();
-				printf("div r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
+				emit(ASMO_DIV, R(reg), V(root->lhs->val), V(root->rhs->val));
 			}
 			return reg;
 
@@ -682,7 +698,7 @@ int codegen(AST *root)
 				reg1 = codegen(root->lhs);
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("rem r%d r%d r%d\n", reg, reg1, reg2);
+				emit(ASMO_REM, R(reg), R(reg1), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -699,7 +715,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
 				reg2 = codegen(root->rhs);
 				reg = newReg();
-				printf("rem r%d %d r%d\n", reg, root->lhs->val, reg2);
+				emit(ASMO_REM, R(reg), V(root->lhs->val), R(reg2));
 				for (i = 0; i < 3; i++) {
 					if (reg2 == var_reg_ref[i])
 						break;
@@ -710,7 +726,7 @@ int codegen(AST *root)
 			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
 				reg1 = codegen(root->lhs);
 				reg = newReg();
-				printf("rem r%d r%d %d\n", reg, reg1, root->rhs->val);
+				emit(ASMO_REM, R(reg), R(reg1), V(root->rhs->val));
 				for (i = 0; i < 3; i++) {
 					if (reg1 == var_reg_ref[i])
 						break;
@@ -720,18 +736,18 @@ int codegen(AST *root)
 			}
 			else {
 				reg = newReg();
-				printf("rem r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
+				emit(ASMO_REM, R(reg), V(root->lhs->val), V(root->rhs->val));
 			}
 			return reg;
 
 		case PREINC:
 			reg = codegen(root->mid);
-			printf("add r%d r%d 1\n", reg, reg);
+			emit(ASMO_ADD, R(reg), R(reg), V(1));
 			return reg;
 
 		case PREDEC:
 			reg = codegen(root->mid);
-			printf("sub r%d r%d 1\n", reg, reg);
+			emit(ASMO_SUB, R(reg), R(reg), V(1));
 			return reg;
 
 		case POSTINC:
@@ -762,7 +778,7 @@ int codegen(AST *root)
 			if (root->val == 'x') {
 				if (var_reg_ref[0] < 0) {
 					reg = newReg();
-					printf("load r%d [0]\n", reg);
+					emit(ASMO_LOAD, R(reg), M(0), NONE);
 					var_reg_ref[0] = reg;
 				}
 				else
@@ -771,7 +787,7 @@ int codegen(AST *root)
 			else if (root->val == 'y') {
 				if (var_reg_ref[1] < 0) {
 					reg = newReg();
-					printf("load r%d [4]\n", reg);
+					emit(ASMO_LOAD, R(reg), M(4), NONE);
 					var_reg_ref[1] = reg;
 				}
 				else
@@ -780,7 +796,7 @@ int codegen(AST *root)
 			else {
 				if (var_reg_ref[2] < 0) {
 					reg = newReg();
-					printf("load r%d [8]\n", reg);
+					emit(ASMO_LOAD, R(reg), M(8), NONE);
 					var_reg_ref[2] = reg;
 				}
 				else
@@ -790,7 +806,7 @@ int codegen(AST *root)
 
 		case CONSTANT:
 			reg = newReg();
-			printf("add r%d r%d %d\n", reg, reg, root->val);
+			emit(ASMO_ADD, R(reg), R(reg), V(root->val));
 			return reg;
 
 		case LPAR:
@@ -806,7 +822,7 @@ int codegen(AST *root)
 		case MINUS:
 			reg2 = codegen(root->mid);
 			reg1 = newReg();
-			printf("sub r%d 0 r%d\n", reg1, reg2);
+			emit(ASMO_SUB, R(reg1), V(0), R(reg2));
 			return reg1;
 
 		default: ;
@@ -833,7 +849,7 @@ int newReg()
 void freeReg(int reg)
 {
 	reg_table[reg] = 0;
-	printf("sub r%d r%d r%d\n", reg, reg, reg);
+	emit(ASMO_SUB, R(reg), R(reg), R(reg));
 
 	return ;
 }
@@ -847,14 +863,14 @@ void postIncDec()
 		if (var_alter[i] != 0) {
 			if (var_reg_ref[i] < 0) {
 				reg = newReg();
-				printf("load r%d [%d]\n", reg, i * 4);
+				emit(ASMO_LOAD, R(reg), M(i * 4), NONE);
 			}
 			else
 				reg = var_reg_ref[i];
 			if (var_alter[i] > 0)
-				printf("add r%d r%d %d\n", reg, reg, var_alter[i]);
+				emit(ASMO_ADD, R(reg), R(reg), V(var_alter[i]));
 			else
-				printf("sub r%d r%d %d\n", reg, reg, var_alter[i] * -1);
+				emit(ASMO_SUB, R(reg), R(reg), V(var_alter[i] * -1));
 			var_reg_ref[i] = reg;
 			var_alter[i] = 0;
 		}
@@ -864,6 +880,30 @@ void postIncDec()
 }
 //*/
 
+// Print one instruction line, or its binary record with "-b".
+void emit(AsmoOp op, AsmoKind kd, int d, AsmoKind ka, int a, AsmoKind kb, int b)
+{
+	AsmoKind kind[3] = {kd, ka, kb};
+	int val[3] = {d, a, b};
+	AsmoInst rec = {op, ASMO_KIND(kd, ka, kb), (uint8_t)d, 0, a, b};
+
+	if (binary_output) {
+		// Operand 0 is a byte; a record that cannot hold it is rejected by the reader.
+		if (op != ASMO_CE && (d < 0 || d > 0xFF))
+			rec.op = ASMO_INVALID;
+		fwrite(&rec, sizeof(rec), 1, stdout);
+		return ;
+	}
+	if (op == ASMO_CE) {
+		puts("Compile Error!");
+		return ;
+	}
+	fputs(asmo_name[op], stdout);
+	for (int i = 0; i < 3 && kind[i] != ASMO_NONE; i++)
+		printf(kind[i] == ASMO_REG ? " r%d" : kind[i] == ASMO_MEM ? " [%d]" : " %d", val[i]);
+	putchar('\n');
+}
+
 // Free the whole AST.
 void freeAST(AST *now) 
 {
@@ -1029,6 +1069,6 @@ void finalIncDec()
 	
 	for (i = 0; i < 3; i++) {
 		if (var_reg_ref[i] >= 0)
-			printf("store [%d] r%d\n", i * 4, var_reg_ref[i]);
+			emit(ASMO_STORE, M(i * 4), R(var_reg_ref[i]), NONE);
 	}
 }
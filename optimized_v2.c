@@ -2,6 +2,12 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include "asm_object.h"
 
 /*
    For the language grammar, please refer to Grammar section on the github page:
@@ -12,6 +18,21 @@ https://github.com/lightbulb12294/CSI2P-II-Mini1#grammar
 
 #define MAX_LENGTH 200
 
+// compile_stream() reads its input in blocks of this size.
+#define READ_BLOCK 65536
+
+// The ASMC default machine model (AssemblyCompiler/libasmc.h): cycles per
+// instruction, indexed by AsmoOp, doubled for an instruction that touches a
+// register >= PENALTY_REG. The passes estimate their savings with it.
+static const int inst_cost[] = {10, 10, 30, 50, 60, 200, 200};
+#define PENALTY_REG 8
+#define PENALTY_FACTOR 2
+
+// Multiplications by constants within CHAIN_RANGE are tried as chains of at
+// most CHAIN_MAX additions and subtractions.
+#define CHAIN_MAX 4
+#define CHAIN_RANGE 64
+
 typedef enum {
 	ASSIGN, ADD, SUB, MUL, DIV, REM, PREINC, PREDEC, POSTINC, POSTDEC, IDENTIFIER, CONSTANT, LPAR, RPAR, PLUS, MINUS, END
 } Kind;
@@ -23,7 +44,6 @@ typedef enum {
 typedef struct TokenUnit {
 	Kind kind;
 	int val; // record the integer value or variable name
-	struct TokenUnit *next;
 } Token;
 
 typedef struct ASTUnit {
@@ -32,39 +52,191 @@ typedef struct ASTUnit {
 	struct ASTUnit *lhs, *mid, *rhs;
 } AST;
 
+// Bump allocator for the tokens and AST nodes of a statement. Chunks are
+// kept across resets, so a steady stream of statements stops calling malloc.
+#define ARENA_CHUNK 4096
+
+typedef struct ArenaChunk {
+	struct ArenaChunk *next;
+	size_t size, used;
+	char data[];
+} ArenaChunk;
+
+typedef struct {
+	ArenaChunk *head, *cur, *tail;
+	// allocs: requests served, i.e. malloc/free pairs avoided; chunks: mallocs made.
+	size_t allocs, chunks, resets;
+} Arena;
+
+// Where an Emitter sends instructions: text lines or object records, through
+// its buffer, into file.
+typedef enum {
+	EMIT_TEXT, EMIT_OBJECT
+} EmitTarget;
+
+// The buffer is flushed with one write() each time it fills up.
+#define EMIT_BUFFER 65536
+
+typedef struct {
+	EmitTarget target;
+	FILE *file;
+	char *buf;
+	size_t len;
+	// insts: instructions emitted; bytes, writes: output write() accepted.
+	size_t insts, bytes, writes;
+	// error: errno of the write that failed, EIO if it wrote nothing. The
+	// rest of the output is dropped from then on.
+	int error;
+} Emitter;
+
+// Operands of emit(): a register, a memory address, an immediate, or none.
+#define R(x) ASMO_REG, (x)
+#define M(x) ASMO_MEM, (x)
+#define V(x) ASMO_VAL, (x)
+#define NONE ASMO_NONE, 0
+
+// An IR operand: a virtual register (ASMO_REG), an address (ASMO_MEM), an
+// immediate (ASMO_VAL) or nothing (ASMO_NONE).
+typedef struct {
+	AsmoKind kind;
+	int val;
+} Operand;
+
+// Splits an Operand into the (kind, value) pair that ir_add() and emit() take.
+#define OP(o) (o).kind, (o).val
+
+// One three-address instruction "op dst a b". dst is a virtual register, or the
+// address of ASMO_STORE; stmt numbers the source statement it was lowered from.
+typedef struct {
+	AsmoOp op;
+	Operand dst, a, b;
+	int stmt;
+} IRInst;
+
+// The program lowered so far. Virtual registers are numbered from 0 and each
+// is defined by exactly one instruction. The whole program is kept, about
+// one IRInst per instruction, because the passes in compile_finish() work
+// across statements. So memory is not bounded per statement: the IR and the
+// per-vreg tables the passes allocate grow linearly with the program.
+typedef struct {
+	IRInst *code;
+	size_t n, cap;
+	// start: first instruction of the statement being lowered.
+	size_t start;
+	int vregs, stmts;
+	// simplified: instructions simplify() removed, in passes passes.
+	size_t simplified;
+	int passes;
+	// reduced: multiplications strength_reduce() replaced, saving saved cycles.
+	size_t reduced;
+	long saved;
+	// fused: remainders fuse_divrem() computed from a division.
+	size_t fused;
+	// numbered: instructions value_number() found redundant, costing
+	// numbered_cycles cycles.
+	size_t numbered;
+	long numbered_cycles;
+	// eliminated: instructions eliminate_dead() removed, clean of them
+	// stores of a variable's unchanged value.
+	size_t eliminated, clean;
+	// penalty_lowest, penalty: estimated r8+ penalty cycles with the lowest
+	// free register for every value (only measured for -s), and with allocate().
+	long penalty_lowest, penalty;
+} IR;
+
+// x * k as additions: step i computes value i + 1 = value a op value b, where
+// value 0 is x and index -1 the immediate 0. extra: registers it needs
+// beyond the one a mul would use.
+typedef struct {
+	int len, extra;
+	struct {
+		AsmoOp op;
+		int a, b;
+	} step[CHAIN_MAX];
+} Chain;
+
+// A virtual register as allocate() ranks it: live over points [def, end),
+// with weight the cycles of the instructions using it.
+typedef struct {
+	long weight;
+	int v, def, end;
+} Interval;
+
+// All state of one compilation. Nothing is shared between contexts, so
+// independent compilations may run in parallel threads.
+typedef struct {
+	// Register i is in use while reg_table[i] == reg_gen; bumping reg_gen frees them all.
+	unsigned reg_table[MAX_REG], reg_gen;
+	int var_alter[3];
+	// The virtual register holding each of x, y, z, or -1 before it is loaded.
+	int var_reg_ref[3];
+	IR ir;
+	Emitter out;
+	// stats: also compute what only -s reports, such as penalty_lowest.
+	int stats;
+	// Tokens and AST nodes of the current statement.
+	Arena arena;
+	// err() returns here.
+	jmp_buf fail;
+} Compiler;
+
+// Result codes of compile_line().
+#define COMPILE_OK 0
+#define COMPILE_ERROR 1
+
 /// utility interfaces
 
-// err marco should be used when a expression error occurs.
+// err marco should be used when a expression error occurs. It needs the Compiler *c in scope.
 #define err(x)\
 {\
-	puts("Compile Error!");\
+	ir_fail(c);\
 	if(DEBUG) {\
 		fprintf(stderr, "Error at line: %d\n", __LINE__);\
 		fprintf(stderr, "Error message: %s\n", x);\
 	}\
-	exit(0);\
+	longjmp(c->fail, 1);\
 }
 
 // You may set DEBUG=1 to debug. Remember setting back to 0 before submit.
 #define DEBUG 0
 
-// Split the input char array into token linked list.
-Token *lexer(const char *in);
+// Split the input char array into a token array (*arr), return its length.
+size_t lexer(Compiler *c, const char *in, Token **arr);
 
 // Create a new token.
-Token *new_token(Kind kind, int val);
-
-// Translate a token linked list into array, return its length.
-size_t token_list_to_arr(Token **head);
+Token new_token(Kind kind, int val);
 
 // Parse the token array. Return the constructed AST.
-AST *parser(Token *arr, size_t len);
+AST *parser(Compiler *c, Token *arr, size_t len);
 
-// Parse the token array. Return the constructed AST.
-AST *parse(Token *arr, int l, int r, GrammarState S);
+// Parse the token array by splitting ranges at operators. O(n * nesting depth);
+// kept as the reference for the parser benchmark (-B).
+AST *parse(Compiler *c, Token *arr, int l, int r, GrammarState S);
+
+// Return the precedence of a binary operator: 2 for MUL_EXPR, 1 for ADD_EXPR, 0 otherwise.
+int binary_prec(Kind kind);
+
+// Parse an ASSIGN_EXPR at arr[*pos] and move *pos past it. The precedence parser
+// below visits each token once and builds the same AST as parse().
+AST *parse_assign(Compiler *c, Token *arr, int *pos);
+
+// Fold the binary operators of precedence >= min following lhs.
+AST *parse_binary(Compiler *c, Token *arr, int *pos, AST *lhs, int min);
+
+// Parse a UNARY_EXPR at arr[*pos] and move *pos past it.
+AST *parse_unary(Compiler *c, Token *arr, int *pos);
+
+// Parse a POSTFIX_EXPR at arr[*pos] and move *pos past it.
+AST *parse_postfix(Compiler *c, Token *arr, int *pos);
+
+// Return 1 if both trees have the same shape, kinds and values.
+int AST_equal(AST *a, AST *b);
+
+// Time parse() against the precedence parser on nested expressions of 10^3..max tokens.
+void parser_bench(Compiler *c, size_t max);
 
 // Create a new AST node.
-AST *new_AST(Kind kind, int val);
+AST *new_AST(Compiler *c, Kind kind, int val);
 
 // Find the location of next token that fits the condition(cond). Return -1 if not found. Search direction from start to end.
 int findNextSection(Token *arr, int start, int end, int (*cond)(Kind));
@@ -82,36 +254,181 @@ int condMUL(Kind kind);
 int condRPAR(Kind kind);
 
 // Check if the AST is semantically right. This function will call err() automatically if check failed.
-void semantic_check(AST *now);
+void semantic_check(Compiler *c, AST *now);
+
+// Lower the AST into IR instructions. Return the operand holding its value.
+Operand lower(Compiler *c, AST *root);
+
+// Lower "a op b" for a binary operator kind into a new virtual register.
+Operand lower_binary(Compiler *c, Kind kind, Operand a, Operand b);
+
+// Return a virtual register holding o, materializing an immediate.
+int value_reg(Compiler *c, Operand o);
+
+// Allocate a new virtual register.
+int new_vreg(Compiler *c);
+
+// Append "op d a b" to the IR; each operand is R(), M(), V(), OP() or NONE.
+void ir_add(Compiler *c, AsmoOp op, AsmoKind kd, int d, AsmoKind ka, int a, AsmoKind kb, int b);
+
+// Drop the current statement from the IR and end the program with a "Compile Error!".
+void ir_fail(Compiler *c);
+
+// Fold every instruction whose result is known at compile time and merge
+// chains of constant additions or multiplications, repeating until nothing
+// changes. Return the number of instructions removed.
+size_t simplify(Compiler *c);
+
+// Global value numbering. Virtual registers are already in SSA form: every
+// assignment and ++/-- of x, y or z defines a new one, and stores only come at
+// the end. So an instruction repeating the op and operands of an earlier one
+// (either order for + and *) computes the same value; its uses are renamed
+// to the earlier result and it is removed. Return the number removed.
+size_t value_number(Compiler *c);
+
+// Backward liveness from the final stores: remove every instruction whose
+// value cannot reach memory, including overwritten assignments, undone
+// increments and leftovers of simplify(). A store of the value loaded from
+// the same address is removed first: after simplify() and value_number(),
+// x = x; and x++; x--; leave x as its own load. A division or remainder is only
+// removed if its divisor is an immediate other than 0 and -1, so a program
+// that divides by zero or INT_MIN by -1 still traps, as fold() leaves it.
+// Return the number removed.
+size_t eliminate_dead(Compiler *c);
+
+// Compute a % b as a - (a / b) * b wherever a / b is also computed and
+// inst_cost[] says the mul and sub are cheaper than the rem. A division that
+// comes later is moved up to the remainder. Return the number rewritten.
+size_t fuse_divrem(Compiler *c);
+
+// Return 1 if the two operands are the same register or immediate.
+int operand_equal(Operand a, Operand b);
+
+// Replace multiplications by constants with add/sub chains where inst_cost[]
+// says they are cheaper, counting the r8+ penalty that the live values and
+// the chain's temporaries may incur. Return the number replaced.
+size_t strength_reduce(Compiler *c);
+
+// Fill chains[k + CHAIN_RANGE] with the cheapest chain computing x * k.
+void find_chains(Chain *chains, Chain *now, int *val);
+
+// Set last[v] to the last instruction reading v, or its definition if none
+// does; -1 if v is no longer in the IR.
+void ir_last_use(IR *ir, int *last);
+
+// The text syntax has no negative immediates. Rewrite x + -k as x - k and
+// x - -k as x + k, and compute any other negative immediate into a register.
+void legalize(Compiler *c);
 
-// Generate ASM code.
-// void codegen(AST *root);
+// Compute k < 0 into virtual register reg, or a new one if reg < 0, for
+// statement stmt. Return the register.
+int negative_reg(Compiler *c, int k, int stmt, int reg);
 
-///*
-// Generate ASM code.
-int codegen(AST *root);
+// Return the result of in if it is known without running it, else an ASMO_NONE operand.
+Operand fold(const IRInst *in);
 
-// Find available register.
-int newReg();
+// Assign physical registers to the IR with allocate() and emit it.
+void emit_program(Compiler *c);
+
+// Fill phys[v] with a physical register for every virtual register. A
+// register is taken at the definition and given back after the last use.
+// With weighted, the heaviest values that fit eight at a time get r0-r7, the
+// rest r8 and up; else each value takes the lowest free register. Return the
+// number of instructions allocated, short of ir->n at an error or when the
+// registers ran out.
+size_t allocate(Compiler *c, const int *last, int *phys, int weighted);
+
+// Order Intervals by weight, heaviest first, then by length.
+int interval_cmp(const void *a, const void *b);
+
+// Add d to points [l, r) of the max tree over [lo, hi) rooted at node.
+void seg_add(int *mx, int *lz, int node, int lo, int hi, int l, int r, int d);
+
+// Return the maximum over points [l, r) of the max tree over [lo, hi).
+int seg_max(int *mx, int *lz, int node, int lo, int hi, int l, int r);
+
+// Return the r8+ penalty cycles of the first n instructions under phys.
+long penalty_cycles(const IR *ir, size_t n, const int *phys);
+
+// Free all registers.
+void reg_reset(Compiler *c);
+
+// Find available register. Return -1 if all are taken.
+int newReg(Compiler *c);
 
 // Free register.
-void freeReg(int reg);
+void freeReg(Compiler *c, int reg);
 
-void IncDec();
+void IncDec(Compiler *c);
 
 // Optimization
 int optimize(AST *now);
 
-void modgen();
+void modgen(Compiler *c, AST *now);
 
-void preIncDec(AST *now);
+void preIncDec(Compiler *c, AST *now);
 
-void finalIncDec();
+// Store every variable that was loaded or assigned. eliminate_dead() drops
+// the stores of those that end up unchanged.
+void finalIncDec(Compiler *c);
 
 //*/
 
-// Free the whole AST.
-void freeAST(AST *now);
+// Set up a context emitting to target in out.
+void compiler_init(Compiler *c, FILE *out, EmitTarget target);
+
+// Forget all variables and registers, ready for a new program. O(1).
+void compiler_reset(Compiler *c);
+
+// Release what the context holds.
+void compiler_free(Compiler *c);
+
+// Lower one statement into the IR. Return COMPILE_ERROR after it was replaced
+// by "Compile Error!", or without lowering anything once the program failed.
+int compile_line(Compiler *c, const char *line);
+
+// Add the final stores, unless the program failed, and emit the program.
+void compile_finish(Compiler *c);
+
+// Compile a whole program from in, one ';'-terminated statement at a time,
+// and finish it. Statements may span lines and blocks, and a line may hold
+// several. Only the current statement's text, tokens and AST are kept; its
+// IR stays until compile_finish(), so total memory is linear in the program
+// size, not bounded per statement (see IR).
+int compile_stream(Compiler *c, FILE *in);
+
+// Grow the statement buffer of compile_stream() to at least need bytes.
+// Running out of memory fails the program like any other error: return
+// COMPILE_ERROR after "Compile Error!" replaced the current statement.
+int stmt_reserve(Compiler *c, char **stmt, size_t *cap, size_t need);
+
+// Free the tokens and AST nodes of the current statement.
+void compiler_release(Compiler *c);
+
+// Allocate n bytes that live until the next arena_reset().
+void *arena_alloc(Arena *a, size_t n);
+
+// Release everything allocated from the arena, keeping its chunks.
+void arena_reset(Arena *a);
+
+// Free the chunks of the arena.
+void arena_free(Arena *a);
+
+// Set up an emitter. EMIT_OBJECT starts with the object header.
+void emitter_init(Emitter *e, EmitTarget target, FILE *file);
+
+// Append one instruction.
+void emitter_put(Emitter *e, const AsmoInst *in);
+
+// Hand the buffered output to the file, retrying interrupted writes. A
+// failed write is recorded in e->error.
+void emitter_flush(Emitter *e);
+
+// Flush and release the emitter.
+void emitter_free(Emitter *e);
+
+// Format val in decimal at p. Return the end of the digits.
+char *format_int(char *p, int val);
 
 /// debug interfaces
 
@@ -121,53 +438,263 @@ void token_print(Token *in, size_t len);
 // Print AST tree.
 void AST_print(AST *head);
 
-char input[MAX_LENGTH];
+// Emit "op d a b" to the context's emitter; each operand is R(), M(), V() or NONE.
+void emit(Compiler *c, AsmoOp op, AsmoKind kd, int d, AsmoKind ka, int a, AsmoKind kb, int b);
 
-int reg_table[MAX_REG];
+int main(int argc, char **argv) 
+{
+	Compiler c;
+	int binary = 0, stats = 0;
+	size_t bench = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-b"))
+			binary = 1;
+		else if (!strcmp(argv[i], "-s"))
+			stats = 1;
+		else if (!strcmp(argv[i], "-B") && i + 1 < argc)
+			bench = strtoul(argv[++i], NULL, 10);
+	}
+	compiler_init(&c, stdout, binary ? EMIT_OBJECT : EMIT_TEXT);
+	c.stats = stats;
+	if (bench) {
+		parser_bench(&c, bench);
+		compiler_free(&c);
+		return 0;
+	}
+	compile_stream(&c, stdin);
+	compiler_free(&c);
+	if (c.out.error) {
+		fprintf(stderr, "write error: %s\n", strerror(c.out.error));
+		return 1;
+	}
+	if (stats) {
+		fprintf(stderr, "arena: %zu allocations in %zu statements from %zu chunk mallocs\n",
+			c.arena.allocs, c.arena.resets, c.arena.chunks);
+		fprintf(stderr, "ir: %zu instructions, %d virtual registers in %d statements\n",
+			c.ir.n, c.ir.vregs, c.ir.stmts);
+		fprintf(stderr, "simplify: %zu instructions removed in %d passes\n",
+			c.ir.simplified, c.ir.passes);
+		fprintf(stderr, "gvn: %zu redundant instructions removed, about %ld cycles saved\n",
+			c.ir.numbered, c.ir.numbered_cycles);
+		fprintf(stderr, "dce: %zu dead instructions removed, %zu of them stores of unchanged variables\n",
+			c.ir.eliminated, c.ir.clean);
+		fprintf(stderr, "divrem: %zu remainders computed from a division\n",
+			c.ir.fused);
+		fprintf(stderr, "strength: %zu multiplications replaced, about %ld cycles saved\n",
+			c.ir.reduced, c.ir.saved);
+		fprintf(stderr, "regalloc: about %ld penalty cycles, %ld with lowest free registers\n",
+			c.ir.penalty, c.ir.penalty_lowest);
+		fprintf(stderr, "emit: %zu instructions, %zu bytes in %zu writes\n",
+			c.out.insts, c.out.bytes, c.out.writes);
+	}
 
-int var_alter[3];
+	return 0;
+}
 
-int var_reg_ref[3] = {-1, -1, -1};
+void compiler_init(Compiler *c, FILE *out, EmitTarget target)
+{
+	memset(c->reg_table, 0, sizeof(c->reg_table));
+	c->reg_gen = 0;
+	emitter_init(&c->out, target, out);
+	memset(&c->arena, 0, sizeof(c->arena));
+	memset(&c->ir, 0, sizeof(c->ir));
+	c->stats = 0;
+	compiler_reset(c);
+}
 
-int main() 
+void compiler_reset(Compiler *c)
 {
-	while (fgets(input, MAX_LENGTH, stdin) != NULL) {
-		Token *content = lexer(input);
-		size_t len = token_list_to_arr(&content);
-//		token_print(content, len);
-		if (len == 0) 
-			continue;
-		AST *ast_root = parser(content, len);
-//		AST_print(ast_root);
-		semantic_check(ast_root);
-		if (optimize(ast_root)) {
-			preIncDec(ast_root);
-			IncDec();
-			codegen(ast_root);
+	int i;
+
+	reg_reset(c);
+	for (i = 0; i < 3; i++) {
+		c->var_alter[i] = 0;
+		c->var_reg_ref[i] = -1;
+	}
+	c->ir.n = c->ir.start = 0;
+	c->ir.vregs = c->ir.stmts = 0;
+}
+
+void compiler_free(Compiler *c)
+{
+	arena_free(&c->arena);
+	free(c->ir.code);
+	c->ir.code = NULL;
+	emitter_free(&c->out);
+}
+
+int compile_line(Compiler *c, const char *line)
+{
+	Token *content;
+	size_t len;
+	AST *ast_root;
+
+	// Nothing may follow the "Compile Error!" of an earlier statement.
+	if (c->ir.n > 0 && c->ir.code[c->ir.n - 1].op == ASMO_CE)
+		return COMPILE_ERROR;
+	if (setjmp(c->fail)) {
+		compiler_release(c);
+		return COMPILE_ERROR;
+	}
+	c->ir.start = c->ir.n;
+	len = lexer(c, line, &content);
+	if (len == 0) {
+		compiler_release(c);
+		return COMPILE_OK;
+	}
+//	token_print(content, len);
+	ast_root = parser(c, content, len);
+//	AST_print(ast_root);
+	semantic_check(c, ast_root);
+	if (optimize(ast_root)) {
+		preIncDec(c, ast_root);
+		IncDec(c);
+		lower(c, ast_root);
+	}
+	else
+		modgen(c, ast_root);
+	IncDec(c);
+	c->ir.stmts++;
+	compiler_release(c);
+	return COMPILE_OK;
+}
+
+void compile_finish(Compiler *c)
+{
+	if (c->ir.n == 0 || c->ir.code[c->ir.n - 1].op != ASMO_CE)
+		finalIncDec(c);
+	simplify(c);
+	// Numbering exposes x - x and x / x over equal values; fold those too.
+	if (value_number(c))
+		simplify(c);
+	eliminate_dead(c);
+	fuse_divrem(c);
+	strength_reduce(c);
+	legalize(c);
+	emit_program(c);
+}
+
+int stmt_reserve(Compiler *c, char **stmt, size_t *cap, size_t need)
+{
+	char *grown;
+
+	c->ir.start = c->ir.n;
+	if (setjmp(c->fail))
+		return COMPILE_ERROR;
+	grown = (char*)realloc(*stmt, need * 2);
+	if (grown == NULL)
+		err("statement too long for memory");
+	*stmt = grown;
+	*cap = need * 2;
+	return COMPILE_OK;
+}
+
+int compile_stream(Compiler *c, FILE *in)
+{
+	char block[READ_BLOCK], *stmt = NULL, *end;
+	size_t n, len = 0, cap = 0, take;
+	int res = COMPILE_OK;
+
+	while (res == COMPILE_OK && (n = fread(block, 1, READ_BLOCK, in)) > 0) {
+		for (char *p = block; res == COMPILE_OK && p < block + n; p += take) {
+			end = (char*)memchr(p, ';', block + n - p);
+			take = (end != NULL ? end + 1 : block + n) - p;
+			if (len + take + 1 > cap && (res = stmt_reserve(c, &stmt, &cap, len + take + 1)) != COMPILE_OK)
+				break;
+			memcpy(stmt + len, p, take);
+			len += take;
+			if (end != NULL) {
+				stmt[len] = '\0';
+				res = compile_line(c, stmt);
+				len = 0;
+			}
 		}
+	}
+	// Whatever follows the last ';' must be blank; compile_line() rejects the rest.
+	if (res == COMPILE_OK && len > 0) {
+		stmt[len] = '\0';
+		res = compile_line(c, stmt);
+	}
+	compile_finish(c);
+	free(stmt);
+	return res;
+}
+
+void compiler_release(Compiler *c)
+{
+	arena_reset(&c->arena);
+}
+
+void *arena_alloc(Arena *a, size_t n)
+{
+	ArenaChunk *ch = a->cur;
+	size_t size;
+
+	n = (n + 15) & ~(size_t)15;
+	while (ch != NULL && ch->used + n > ch->size) {
+		ch = ch->next;
+		if (ch != NULL)
+			ch->used = 0;
+	}
+	if (ch == NULL) {
+		size = n > ARENA_CHUNK ? n : ARENA_CHUNK;
+		ch = (ArenaChunk*)malloc(sizeof(ArenaChunk) + size);
+		ch->next = NULL;
+		ch->size = size;
+		ch->used = 0;
+		if (a->tail != NULL)
+			a->tail->next = ch;
 		else
-			modgen(ast_root);
-		IncDec();
-		free(content);
-		freeAST(ast_root);
+			a->head = ch;
+		a->tail = ch;
+		a->chunks++;
 	}
-	finalIncDec();
+	a->cur = ch;
+	a->allocs++;
+	ch->used += n;
+	return ch->data + ch->used - n;
+}
 
-	return 0;
+void arena_reset(Arena *a)
+{
+	a->cur = a->head;
+	if (a->cur != NULL)
+		a->cur->used = 0;
+	a->resets++;
+}
+
+void arena_free(Arena *a)
+{
+	ArenaChunk *del;
+
+	while (a->head != NULL) {
+		del = a->head;
+		a->head = del->next;
+		free(del);
+	}
+	a->cur = a->tail = NULL;
 }
 
-// Split the input char array into token linked list.
-Token *lexer(const char *in) 
+// Split the input char array into a token array (*arr), return its length.
+// There is at most one token per character, so the array is sized up front.
+size_t lexer(Compiler *c, const char *in, Token **arr) 
 {
-	Token *head = NULL;
-	Token **now = &head;
+	Token *head = (Token*)arena_alloc(&c->arena, sizeof(Token) * (strlen(in) + 1));
+	Token *now = head;
+	int val;
 	
 	for (int i = 0; in[i]; i++) {
 		if (isspace(in[i])) // ignore space characters
 			continue;
 		else if (isdigit(in[i])) {
-			(*now) = new_token(CONSTANT, atoi(in + i));
-			while (in[i+1] && isdigit(in[i+1])) i++;
+			// Check before multiplying, so val never leaves the int range.
+			for (val = in[i] - '0'; isdigit(in[i+1]); i++) {
+				if (val > (INT_MAX - (in[i+1] - '0')) / 10)
+					err("Integer constant out of range.");
+				val = val * 10 + (in[i+1] - '0');
+			}
+			(*now) = new_token(CONSTANT, val);
 		}
 		else if ('x' <= in[i] && in[i] <= 'z') // variable
 			(*now) = new_token(IDENTIFIER, in[i]);
@@ -214,42 +741,24 @@ Token *lexer(const char *in)
 			default:
 				err("Unexpected character.");
 		}
-		now = &((*now)->next);
+		now++;
 	}
-	return head;
+	*arr = head;
+	return now - head;
 }
 
 // Create a new token.
-Token *new_token(Kind kind, int val) 
+Token new_token(Kind kind, int val) 
 {
-	Token *res = (Token*)malloc(sizeof(Token));
+	Token res;
 	
-	res->kind = kind;
-	res->val = val;
-	res->next = NULL;
-	return res;
-}
-
-// Translate a token linked list into array, return its length.
-size_t token_list_to_arr(Token **head) 
-{
-	size_t res;
-	Token *now = (*head), *del;
-	
-	for (res = 0; now != NULL; res++) now = now->next;
-	now = (*head);
-	if (res != 0) (*head) = (Token*)malloc(sizeof(Token) * res);
-	for (int i = 0; i < res; i++) {
-		(*head)[i] = (*now);
-		del = now;
-		now = now->next;
-		free(del);
-	}
+	res.kind = kind;
+	res.val = val;
 	return res;
 }
 
 // Parse the token array. Return the constructed AST.
-AST *parser(Token *arr, size_t len) 
+AST *parser(Compiler *c, Token *arr, size_t len) 
 {
 	for (int i = 1; i < len; i++) {
 		// correctly identify "ADD" and "SUB"
@@ -265,11 +774,21 @@ AST *parser(Token *arr, size_t len)
 			}
 		}
 	}
-	return parse(arr, 0, len - 1, STMT);
+	// STMT: an empty statement or an EXPR followed by ';'
+	if (arr[len - 1].kind != END)
+		err("Expected \';\' at the end of line.");
+	if (len == 1)
+		return NULL;
+	int pos = 0;
+	AST *now = parse_assign(c, arr, &pos);
+	// The END at len - 1 stops every parse_*() call, so nothing reads past it.
+	if (pos != len - 1)
+		err("Unexpected token during parsing.");
+	return now;
 }
 
 // Parse the token array. Return the constructed AST.
-AST *parse(Token *arr, int l, int r, GrammarState S) 
+AST *parse(Compiler *c, Token *arr, int l, int r, GrammarState S) 
 {
 	AST *now = NULL;
 	
@@ -281,62 +800,62 @@ AST *parse(Token *arr, int l, int r, GrammarState S)
 			if (l == r && arr[l].kind == END)
 				return NULL;
 			else if (arr[r].kind == END)
-				return parse(arr, l, r - 1, EXPR);
+				return parse(c, arr, l, r - 1, EXPR);
 			else err("Expected \';\' at the end of line.");
 		case EXPR:
-			return parse(arr, l, r, ASSIGN_EXPR);
+			return parse(c, arr, l, r, ASSIGN_EXPR);
 		case ASSIGN_EXPR:
 			if ((nxt = findNextSection(arr, l, r, condASSIGN)) != -1) {
-				now = new_AST(arr[nxt].kind, 0);
-				now->lhs = parse(arr, l, nxt - 1, UNARY_EXPR);
-				now->rhs = parse(arr, nxt + 1, r, ASSIGN_EXPR);
+				now = new_AST(c, arr[nxt].kind, 0);
+				now->lhs = parse(c, arr, l, nxt - 1, UNARY_EXPR);
+				now->rhs = parse(c, arr, nxt + 1, r, ASSIGN_EXPR);
 				return now;
 			}
-			return parse(arr, l, r, ADD_EXPR);
+			return parse(c, arr, l, r, ADD_EXPR);
 		case ADD_EXPR:
 			if((nxt = findNextSection(arr, r, l, condADD)) != -1) {
-				now = new_AST(arr[nxt].kind, 0);
-				now->lhs = parse(arr, l, nxt - 1, ADD_EXPR);
-				now->rhs = parse(arr, nxt + 1, r, MUL_EXPR);
+				now = new_AST(c, arr[nxt].kind, 0);
+				now->lhs = parse(c, arr, l, nxt - 1, ADD_EXPR);
+				now->rhs = parse(c, arr, nxt + 1, r, MUL_EXPR);
 				return now;
 			}
-			return parse(arr, l, r, MUL_EXPR);
+			return parse(c, arr, l, r, MUL_EXPR);
 		case MUL_EXPR:
 			// TODO: Implement MUL_EXPR.
 			// hint: Take ADD_EXPR as reference.
 			if ((nxt = findNextSection(arr, r, l, condMUL)) != -1) {
-				now = new_AST(arr[nxt].kind, 0);
-				now->lhs = parse(arr, l, nxt - 1, MUL_EXPR);
-				now->rhs = parse(arr, nxt + 1, r, UNARY_EXPR);
+				now = new_AST(c, arr[nxt].kind, 0);
+				now->lhs = parse(c, arr, l, nxt - 1, MUL_EXPR);
+				now->rhs = parse(c, arr, nxt + 1, r, UNARY_EXPR);
 				return now;
 			}
-			return parse(arr, l, r, UNARY_EXPR);
+			return parse(c, arr, l, r, UNARY_EXPR);
 		case UNARY_EXPR:
 			// TODO: Implement UNARY_EXPR.
 			// hint: Take POSTFIX_EXPR as reference.
 			if (arr[l].kind == PREINC || arr[l].kind == PREDEC || arr[l].kind == PLUS || arr[l].kind == MINUS) {
-				now = new_AST(arr[l].kind, 0);
-				now->mid = parse(arr, l + 1, r, UNARY_EXPR);
+				now = new_AST(c, arr[l].kind, 0);
+				now->mid = parse(c, arr, l + 1, r, UNARY_EXPR);
 				return now;
 			}
-			return parse(arr, l, r, POSTFIX_EXPR);
+			return parse(c, arr, l, r, POSTFIX_EXPR);
 		case POSTFIX_EXPR:
 			if (arr[r].kind == PREINC || arr[r].kind == PREDEC) {
 				// translate "PREINC", "PREDEC" into "POSTINC", "POSTDEC"
-				now = new_AST(arr[r].kind - PREINC + POSTINC, 0);
-				now->mid = parse(arr, l, r - 1, POSTFIX_EXPR);
+				now = new_AST(c, arr[r].kind - PREINC + POSTINC, 0);
+				now->mid = parse(c, arr, l, r - 1, POSTFIX_EXPR);
 				return now;
 			}
-			return parse(arr, l, r, PRI_EXPR);
+			return parse(c, arr, l, r, PRI_EXPR);
 		case PRI_EXPR:
 			if (findNextSection(arr, l, r, condRPAR) == r) {
-				now = new_AST(LPAR, 0);
-				now->mid = parse(arr, l + 1, r - 1, EXPR);
+				now = new_AST(c, LPAR, 0);
+				now->mid = parse(c, arr, l + 1, r - 1, EXPR);
 				return now;
 			}
 			if (l == r) {
 				if (arr[l].kind == IDENTIFIER || arr[l].kind == CONSTANT)
-					return new_AST(arr[l].kind, arr[l].val);
+					return new_AST(c, arr[l].kind, arr[l].val);
 				err("Unexpected token during parsing.");
 			}
 			err("No token left for parsing.");
@@ -345,10 +864,159 @@ AST *parse(Token *arr, int l, int r, GrammarState S)
 	}
 }
 
+// Return the precedence of a binary operator: 2 for MUL_EXPR, 1 for ADD_EXPR, 0 otherwise.
+int binary_prec(Kind kind) 
+{
+	if (condMUL(kind))
+		return 2;
+	if (condADD(kind))
+		return 1;
+	return 0;
+}
+
+// Parse an ASSIGN_EXPR at arr[*pos] and move *pos past it.
+AST *parse_assign(Compiler *c, Token *arr, int *pos) 
+{
+	AST *now, *lhs = parse_unary(c, arr, pos);
+	
+	// The left side of '=' must be a UNARY_EXPR, so "x + y = 1" is an error
+	// as in parse(): the '=' is left over once the ADD_EXPR is folded.
+	if (arr[*pos].kind == ASSIGN) {
+		now = new_AST(c, ASSIGN, 0);
+		(*pos)++;
+		now->lhs = lhs;
+		now->rhs = parse_assign(c, arr, pos);
+		return now;
+	}
+	return parse_binary(c, arr, pos, lhs, 1);
+}
+
+// Fold the binary operators of precedence >= min following lhs.
+AST *parse_binary(Compiler *c, Token *arr, int *pos, AST *lhs, int min) 
+{
+	AST *now, *rhs;
+	int prec;
+	
+	while ((prec = binary_prec(arr[*pos].kind)) >= min) {
+		now = new_AST(c, arr[*pos].kind, 0);
+		(*pos)++;
+		rhs = parse_unary(c, arr, pos);
+		// A tighter operator takes rhs first; equal ones loop here (left associative).
+		if (binary_prec(arr[*pos].kind) > prec)
+			rhs = parse_binary(c, arr, pos, rhs, prec + 1);
+		now->lhs = lhs;
+		now->rhs = rhs;
+		lhs = now;
+	}
+	return lhs;
+}
+
+// Parse a UNARY_EXPR at arr[*pos] and move *pos past it.
+AST *parse_unary(Compiler *c, Token *arr, int *pos) 
+{
+	AST *now;
+	Kind kind = arr[*pos].kind;
+	
+	if (kind == PREINC || kind == PREDEC || kind == PLUS || kind == MINUS) {
+		now = new_AST(c, kind, 0);
+		(*pos)++;
+		now->mid = parse_unary(c, arr, pos);
+		return now;
+	}
+	return parse_postfix(c, arr, pos);
+}
+
+// Parse a POSTFIX_EXPR at arr[*pos] and move *pos past it.
+AST *parse_postfix(Compiler *c, Token *arr, int *pos) 
+{
+	AST *now;
+	Kind kind = arr[*pos].kind;
+	
+	// PRI_EXPR
+	if (kind == LPAR) {
+		now = new_AST(c, LPAR, 0);
+		(*pos)++;
+		now->mid = parse_assign(c, arr, pos);
+		if (arr[*pos].kind != RPAR)
+			err("Expected \')\'.");
+		(*pos)++;
+	}
+	else if (kind == IDENTIFIER || kind == CONSTANT) {
+		now = new_AST(c, kind, arr[*pos].val);
+		(*pos)++;
+	}
+	else err("Unexpected token during parsing.");
+	// translate "PREINC", "PREDEC" into "POSTINC", "POSTDEC"
+	while (arr[*pos].kind == PREINC || arr[*pos].kind == PREDEC) {
+		AST *tmp = new_AST(c, arr[*pos].kind - PREINC + POSTINC, 0);
+		tmp->mid = now;
+		now = tmp;
+		(*pos)++;
+	}
+	return now;
+}
+
+// Return 1 if both trees have the same shape, kinds and values.
+int AST_equal(AST *a, AST *b) 
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	return a->kind == b->kind && a->val == b->val && AST_equal(a->lhs, b->lhs)
+		&& AST_equal(a->mid, b->mid) && AST_equal(a->rhs, b->rhs);
+}
+
+// Time parse() against the precedence parser on nested expressions of 10^3..max tokens.
+// The statement is "x = (y + 2 * z - 6 * ... * (y + 2 * ... z)...);" with 32
+// chain tokens per level, so parse() rescans the inner levels at every depth.
+void parser_bench(Compiler *c, size_t max) 
+{
+	static const Kind unit[4] = {ADD, MUL, SUB, MUL};
+	Token *arr;
+	AST *split, *prec;
+	clock_t t0, t1, t2;
+	size_t n, len, depth, i, k;
+	
+	printf("%10s %8s %14s %14s\n", "tokens", "depth", "parse() ms", "precedence ms");
+	for (n = 1000; n <= max; n *= 10) {
+		if (setjmp(c->fail)) {
+			fprintf(stderr, "parser_bench: parse failed at %zu tokens\n", n);
+			return;
+		}
+		depth = n / 66;
+		arr = (Token*)arena_alloc(&c->arena, sizeof(Token) * (n + 8));
+		len = 0;
+		arr[len++] = new_token(IDENTIFIER, 'x');
+		arr[len++] = new_token(ASSIGN, 0);
+		for (i = 0; i < depth; i++) {
+			arr[len++] = new_token(LPAR, 0);
+			for (k = 0; k < 32; k += 2) {
+				arr[len++] = k % 4 ? new_token(CONSTANT, k) : new_token(IDENTIFIER, 'y' + k % 8 / 4);
+				arr[len++] = new_token(unit[k / 2 % 4], 0);
+			}
+		}
+		while (len + depth + 2 < n) {
+			arr[len++] = new_token(IDENTIFIER, 'y');
+			arr[len++] = new_token(ADD, 0);
+		}
+		arr[len++] = new_token(IDENTIFIER, 'z');
+		for (i = 0; i < depth; i++)
+			arr[len++] = new_token(RPAR, 0);
+		arr[len++] = new_token(END, 0);
+		t0 = clock();
+		split = parse(c, arr, 0, len - 1, STMT);
+		t1 = clock();
+		prec = parser(c, arr, len);
+		t2 = clock();
+		printf("%10zu %8zu %14.3f %14.3f%s\n", len, depth, (t1 - t0) * 1000.0 / CLOCKS_PER_SEC,
+			(t2 - t1) * 1000.0 / CLOCKS_PER_SEC, AST_equal(split, prec) ? "" : "  (ASTs differ!)");
+		compiler_release(c);
+	}
+}
+
 // Create a new AST node.
-AST *new_AST(Kind kind, int val) 
+AST *new_AST(Compiler *c, Kind kind, int val) 
 {
-	AST *res = (AST*)malloc(sizeof(AST));
+	AST *res = (AST*)arena_alloc(&c->arena, sizeof(AST));
 	res->kind = kind;
 	res->val = val;
 	res->lhs = res->mid = res->rhs = NULL;
@@ -394,7 +1062,7 @@ int condRPAR(Kind kind)
 }
 
 // Check if the AST is semantically right. This function will call err() automatically if check failed.
-void semantic_check(AST *now) 
+void semantic_check(Compiler *c, AST *now) 
 {
 	AST *tmp;
 
@@ -409,7 +1077,7 @@ void semantic_check(AST *now)
 			err("Lvalue is required as left operand of assignment.");
 			return ;
 		}
-		semantic_check(now->rhs);
+		semantic_check(c, now->rhs);
 	}
 	// Operand of INC/DEC must be an identifier or identifier with one or more parentheses.
 	// TODO: Implement the remaining semantic_check code.
@@ -430,575 +1098,911 @@ void semantic_check(AST *now)
 		return ;
 	}
 	else {
-		semantic_check(now->lhs);
-		semantic_check(now->mid);
-		semantic_check(now->rhs);
+		semantic_check(c, now->lhs);
+		semantic_check(c, now->mid);
+		semantic_check(c, now->rhs);
 	}
 
 	return ;
 }
 
-// Generate ASM code.
-// void codegen(AST *root) {}
-
-///*
-int codegen(AST *root)
+Operand lower(Compiler *c, AST *root)
 {
 	AST *tmp;
-	int reg, reg1, reg2;
+	Operand res, a, b;
 	int i;
 
-	// TODO: Implement your codegen in your own way.
-	// You may modify the function parameter or the return type, even the whole structure as you wish.
-	if (root == NULL)
-		return -1;
 	switch (root->kind) {
 		case ASSIGN:
 			tmp = root->lhs;
 			while (tmp->kind == LPAR)
 				tmp = tmp->mid;
-			reg1 = codegen(root->rhs);
-			if (tmp->val == 'x') {
-				if (var_reg_ref[0] >= 0) {
-					reg = var_reg_ref[0];
-					if (reg1 != -1)
-						printf("add r%d r%d 0\n", var_reg_ref[0], reg1);
-					else
-						printf("add r%d 0 0\n", var_reg_ref[0]);
-				}
-				else {
-					reg = newReg();
-					if (reg1 != -1)
-						printf("add r%d r%d 0\n", reg, reg1);
-					else
-						printf("add r%d 0 0\n", reg);
-					var_reg_ref[0] = reg;
-				}
-			}
-			else if (tmp->val == 'y') {
-				if (var_reg_ref[1] >= 0) {
-					reg = var_reg_ref[1];
-					if (reg1 != -1)
-						printf("add r%d r%d 0\n", var_reg_ref[1], reg1);
-					else
-						printf("add r%d 0 0\n", var_reg_ref[1]);
-				}		
-				else {
-					reg = newReg();
-					if (reg1 != -1)
-						printf("add r%d r%d 0\n", reg, reg1);
-					else 
-						printf("add r%d 0 0\n", reg);
-					var_reg_ref[1] = reg;
-				}
-			}
-			else {
-				if (var_reg_ref[2] >= 0) {
-					reg = var_reg_ref[2];
-					if (reg1 != -1)
-						printf("add r%d r%d 0\n", var_reg_ref[2], reg1);
-					else
-						printf("add r%d 0 0\n", var_reg_ref[2]);
-				}
-				else {
-					reg = newReg();
-					if (reg1 != -1)
-						printf("add r%d r%d 0\n", reg, reg1);
-					else
-						printf("add r%d 0 0\n", reg);
-					var_reg_ref[2] = reg;
-				}
-			}
-			return reg;
+			res = lower(c, root->rhs);
+			// Variables are bound to the register of their value; nothing is copied.
+			c->var_reg_ref[tmp->val - 'x'] = value_reg(c, res);
+			res.kind = ASMO_REG;
+			res.val = c->var_reg_ref[tmp->val - 'x'];
+			return res;
 
 		case ADD:
-			if (root->lhs->kind != CONSTANT && root->rhs->kind != CONSTANT) {
-				reg1 = codegen(root->lhs);
-				reg2 = codegen(root->rhs);
-				if (reg1 == -1)
-					return reg2;
-				else if (reg2 == -1)
-					return reg1;
-				reg = newReg();
-				printf("add r%d r%d r%d\n", reg, reg1, reg2);
-				for (i = 0; i < 3; i++) {
-					if (reg1 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg1);
-				for (i = 0; i < 3; i++) {
-					if (reg2 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg2);;
-			}
-			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
-				reg2 = codegen(root->rhs);
-				if (root->lhs->val == 0)
-					return reg2;
-				else {
-					reg = newReg();
-					if (reg2 != -1)
-						printf("add r%d %d r%d\n", reg, root->lhs->val, reg2);
-					else
-						printf("add r%d %d 0\n", reg, root->lhs->val);
-				}
-				for (i = 0; i < 3; i++) {
-					if (reg2 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg2);;
-			}
-			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
-				reg1 = codegen(root->lhs);
-				if (root->rhs->val == 0)
-					return reg1;
-				else {
-					reg = newReg();
-					if (reg1 != -1)
-						printf("add r%d r%d %d\n", reg, reg1, root->rhs->val);
-					else
-						printf("add r%d 0 %d\n", reg, root->rhs->val);
-				}
-				for (i = 0; i < 3; i++) {
-					if (reg1 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg1);;
-			}
-			else {
-				reg = newReg();
-				printf("add r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
-			}
-			return reg;
-
 		case SUB:
-			if (root->lhs->kind != CONSTANT && root->rhs->kind != CONSTANT) {
-				reg1 = codegen(root->lhs);
-				reg2 = codegen(root->rhs);
-				if (reg1 == reg2)
-					return -1;
-				if (reg2 == -1)
-					return reg1;
-				else if (reg1 == -1) {
-					reg = newReg();
-					printf("sub r%d 0 r%d\n", reg, reg2);
-				}
-				else {
-					reg = newReg();
-					printf("sub r%d r%d r%d\n", reg, reg1, reg2);
-				}
-				for (i = 0; i < 3; i++) {
-					if (reg1 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg1);;
-				for (i = 0; i < 3; i++) {
-					if (reg2 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg2);;
-			}
-			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
-				reg2 = codegen(root->rhs);
-				if (reg2 != -1) {
-					reg = newReg();
-					printf("sub r%d %d r%d\n", reg, root->lhs->val, reg2);
-				}
-				else if (root->lhs->val == 0)
-					return -1;
-				else {
-					reg = newReg();
-					printf("sub r%d %d 0\n", reg, root->lhs->val);
-				}
-				for (i = 0; i < 3; i++) {
-					if (reg2 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg2);;
-			}
-			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
-				reg1 = codegen(root->lhs);
-				if (root->rhs->val == 0)
-					return reg1;
-				else if (reg1 != -1) {
-					reg = newReg();
-					printf("sub r%d r%d %d\n", reg, reg1, root->rhs->val);
-				}
-				else {
-					reg = newReg();
-					printf("sub r%d 0 %d\n", reg, root->rhs->val);
-				}
-				for (i = 0; i < 3; i++) {
-					if (reg1 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg1);;
-			}
-			else {
-				if (root->lhs->val == root->rhs->val)
-					return -1;
-				else {
-					reg = newReg();
-					printf("sub r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
-				}
-			}
-			return reg;
-
 		case MUL:
-			if (root->lhs->kind != CONSTANT && root->rhs->kind != CONSTANT) {
-				reg1 = codegen(root->lhs);
-				reg2 = codegen(root->rhs);
-				if (reg1 == -1 || reg2 == -1)
-					return -1;
-				else {
-					reg = newReg();
-					printf("mul r%d r%d r%d\n", reg, reg1, reg2);
-				}
-				for (i = 0; i < 3; i++) {
-					if (reg1 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg1);;
-				for (i = 0; i < 3; i++) {
-					if (reg2 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg2);;
-			}
-			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
-				reg2 = codegen(root->rhs);
-				if (root->lhs->val == 0 || reg2 == -1)
-					return -1;
-				else if (root->lhs->val == 1)
-					return reg2;
-				else {
-					reg = newReg();
-					printf("mul r%d %d r%d\n", reg, root->lhs->val, reg2);
-				}
-				for (i = 0; i < 3; i++) {
-					if (reg2 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg2);;
-			}
-			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
-				reg1 = codegen(root->lhs);
-				if (root->rhs->val == 0 || reg1 == -1)
-					return -1;
-				else if (root->rhs->val == 1)
-					return reg1;
-				else {
-					reg = newReg();
-					printf("mul r%d r%d %d\n", reg, reg1, root->rhs->val);
-				}
-				for (i = 0; i < 3; i++) {
-					if (reg1 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg1);;
-			}
-			else {
-				if (root->lhs->val == 0 || root->rhs->val == 0)
-					return -1;
-				else if (root->lhs->val == 1) {
-					reg = newReg();
-					printf("add r%d 0 %d\n", reg, root->rhs->val);
-				}
-				else if (root->rhs->val == 1) {
-					reg = newReg();
-					printf("add r%d %d 0\n", reg, root->lhs->val);
-				}
-				else {
-					reg = newReg();
-					printf("mul r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
-				}
-			}
-			return reg;
-
 		case DIV:
-			if (root->lhs->kind != CONSTANT && root->rhs->kind != CONSTANT) {
-				reg1 = codegen(root->lhs);
-				reg2 = codegen(root->rhs);
-				if (reg1 == -1)
-					return -1;
-				else {
-					reg = newReg();
-					printf("div r%d r%d r%d\n", reg, reg1, reg2);
-				}
-				for (i = 0; i < 3; i++) {
-					if (reg1 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg1);;
-				for (i = 0; i < 3; i++) {
-					if (reg2 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg2);;
+		case REM:
+			// Lower the operands in source order: an assignment on the left
+			// is seen by the right, and a left-leaning chain keeps one
+			// partial result live instead of all its terms.
+			a = lower(c, root->lhs);
+			b = lower(c, root->rhs);
+			return lower_binary(c, root->kind, a, b);
+
+		case PREINC:
+		case PREDEC:
+			// preIncDec() has already applied them.
+			return lower(c, root->mid);
+
+		case POSTINC:
+		case POSTDEC:
+			tmp = root->mid;
+			while (tmp->kind == LPAR)
+				tmp = tmp->mid;
+			c->var_alter[tmp->val - 'x'] += root->kind == POSTINC ? 1 : -1;
+			return lower(c, tmp);
+
+		case IDENTIFIER:
+			i = root->val - 'x';
+			if (c->var_reg_ref[i] < 0) {
+				c->var_reg_ref[i] = new_vreg(c);
+				ir_add(c, ASMO_LOAD, R(c->var_reg_ref[i]), M(i * 4), NONE);
 			}
-			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
-				reg2 = codegen(root->rhs);
-				if (root->lhs->val == 0)
-					return -1;
-				else {
-					reg = newReg();
-					printf("div r%d %d r%d\n", reg, root->lhs->val, reg2);
-				}
-				for (i = 0; i < 3; i++) {
-					if (reg2 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg2);;
+			res.kind = ASMO_REG;
+			res.val = c->var_reg_ref[i];
+			return res;
+
+		case CONSTANT:
+			res.kind = ASMO_VAL;
+			res.val = root->val;
+			return res;
+
+		case LPAR:
+		case PLUS:
+			return lower(c, root->mid);
+
+		case MINUS:
+			res = lower(c, root->mid);
+			i = new_vreg(c);
+			ir_add(c, ASMO_SUB, R(i), V(0), OP(res));
+			res.kind = ASMO_REG;
+			res.val = i;
+			return res;
+
+		default: ;
+	}
+	err("Invalid AST node in tree.");
+}
+
+Operand lower_binary(Compiler *c, Kind kind, Operand a, Operand b)
+{
+	Operand res;
+
+	res.kind = ASMO_REG;
+	res.val = new_vreg(c);
+	ir_add(c, kind - ADD + ASMO_ADD, R(res.val), OP(a), OP(b));
+	return res;
+}
+
+int value_reg(Compiler *c, Operand o)
+{
+	int reg;
+
+	if (o.kind == ASMO_REG)
+		return o.val;
+	reg = new_vreg(c);
+	ir_add(c, ASMO_ADD, R(reg), V(0), OP(o));
+	return reg;
+}
+
+int new_vreg(Compiler *c)
+{
+	return c->ir.vregs++;
+}
+
+void ir_add(Compiler *c, AsmoOp op, AsmoKind kd, int d, AsmoKind ka, int a, AsmoKind kb, int b)
+{
+	IR *ir = &c->ir;
+	IRInst *in;
+
+	if (ir->n == ir->cap) {
+		ir->cap = ir->cap ? ir->cap * 2 : 1024;
+		ir->code = (IRInst*)realloc(ir->code, ir->cap * sizeof(IRInst));
+	}
+	in = &ir->code[ir->n++];
+	in->op = op;
+	in->dst.kind = kd;
+	in->dst.val = d;
+	in->a.kind = ka;
+	in->a.val = a;
+	in->b.kind = kb;
+	in->b.val = b;
+	in->stmt = ir->stmts;
+}
+
+void ir_fail(Compiler *c)
+{
+	c->ir.n = c->ir.start;
+	ir_add(c, ASMO_CE, NONE, NONE, NONE);
+}
+
+size_t simplify(Compiler *c)
+{
+	IR *ir = &c->ir;
+	// val[v]: what v is known to equal, v itself unless folded. def[v]: its definition.
+	Operand *val = (Operand*)malloc(sizeof(Operand) * (ir->vregs + 1));
+	size_t *def = (size_t*)malloc(sizeof(size_t) * (ir->vregs + 1));
+	char *dead = (char*)calloc(ir->n + 1, 1);
+	Operand res;
+	size_t k, n;
+	int changed, v;
+
+	for (v = 0; v < ir->vregs; v++) {
+		val[v].kind = ASMO_REG;
+		val[v].val = v;
+	}
+	for (k = 0; k < ir->n; k++)
+		if (ir->code[k].dst.kind == ASMO_REG)
+			def[ir->code[k].dst.val] = k;
+	do {
+		changed = 0;
+		ir->passes++;
+		for (k = 0; k < ir->n; k++) {
+			IRInst *in = &ir->code[k];
+			if (dead[k] || in->op == ASMO_STORE || in->op == ASMO_LOAD || in->op == ASMO_CE)
+				continue;
+			// An operand may have folded to a register that only folded in
+			// this pass, so follow val[] to its end.
+			while (in->a.kind == ASMO_REG && !operand_equal(val[in->a.val], in->a))
+				in->a = val[in->a.val];
+			while (in->b.kind == ASMO_REG && !operand_equal(val[in->b.val], in->b))
+				in->b = val[in->b.val];
+			res = fold(in);
+			if (res.kind != ASMO_NONE) {
+				val[in->dst.val] = res;
+				dead[k] = 1;
+				changed = 1;
+				continue;
 			}
-			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
-				reg1 = codegen(root->lhs);
-				if (reg1 == -1)
-					return -1;
-				else if (root->rhs->val == 1)
-					return reg1;
-				else {
-					reg = newReg();
-					printf("div r%d r%d %d\n", reg, reg1, root->rhs->val);
-				}
-				for (i = 0; i < 3; i++) {
-					if (reg1 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg1);;
+			// (f op k1) op k2 becomes f op (k1 op k2), for + and - or for *.
+			IRInst *src, merged = *in;
+			Operand *r = in->a.kind == ASMO_REG ? &in->a : &in->b, *imm = r == &in->a ? &in->b : &in->a;
+			if (r->kind != ASMO_REG || imm->kind != ASMO_VAL)
+				continue;
+			src = &ir->code[def[r->val]];
+			if (src->op == ASMO_LOAD)
+				continue;
+			if (in->op == ASMO_MUL && src->op == ASMO_MUL && (src->a.kind == ASMO_VAL) != (src->b.kind == ASMO_VAL)) {
+				merged.a = src->a.kind == ASMO_REG ? src->a : src->b;
+				merged.b.kind = ASMO_VAL;
+				merged.b.val = (int)((unsigned)imm->val * (unsigned)(src->a.kind == ASMO_VAL ? src->a.val : src->b.val));
 			}
-			else {
-				if (root->lhs->val == 0)
-					return -1;
-				else if (root->rhs->val == 1) {
-					reg = newReg();
-					printf("add r%d %d 0\n", reg, root->lhs->val);
+			else if ((in->op == ASMO_ADD || in->op == ASMO_SUB) && (src->op == ASMO_ADD || src->op == ASMO_SUB)
+				&& (src->a.kind == ASMO_VAL) != (src->b.kind == ASMO_VAL)) {
+				// Both are s * f + k with s = +1 or -1.
+				int s1 = src->op == ASMO_SUB && src->b.kind == ASMO_REG ? -1 : 1;
+				unsigned k1 = src->a.kind == ASMO_VAL ? src->a.val : src->b.val;
+				int s2 = in->op == ASMO_SUB && r == &in->b ? -1 : 1;
+				unsigned k2 = (unsigned)imm->val;
+				if (src->op == ASMO_SUB && src->b.kind == ASMO_VAL)
+					k1 = 0u - k1;
+				if (in->op == ASMO_SUB && r == &in->a)
+					k2 = 0u - k2;
+				k1 = (s2 < 0 ? 0u - k1 : k1) + k2;
+				if (s1 * s2 > 0) {
+					merged.op = ASMO_ADD;
+					merged.a = src->a.kind == ASMO_REG ? src->a : src->b;
+					merged.b.kind = ASMO_VAL;
+					merged.b.val = (int)k1;
 				}
 				else {
-					reg = newReg();
-					printf("div r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
+					merged.op = ASMO_SUB;
+					merged.a.kind = ASMO_VAL;
+					merged.a.val = (int)k1;
+					merged.b = src->a.kind == ASMO_REG ? src->a : src->b;
 				}
 			}
-			return reg;
+			else continue;
+			// Skip a merge whose constant legalize() would have to compute first.
+			v = merged.op == ASMO_SUB ? merged.a.val : merged.b.val;
+			if (merged.op == ASMO_ADD ? v == INT_MIN : v < 0)
+				continue;
+			*in = merged;
+			changed = 1;
+		}
+	} while (changed);
+	// A store needs its value in a register: one that folded to an immediate
+	// is materialized by its own definition.
+	for (k = 0; k < ir->n; k++) {
+		IRInst *in = &ir->code[k];
+		if (in->op != ASMO_STORE || dead[k])
+			continue;
+		v = in->a.val;
+		while (val[v].kind == ASMO_REG && val[v].val != v)
+			v = val[v].val;
+		if (val[v].kind == ASMO_REG) {
+			in->a = val[v];
+			continue;
+		}
+		ir->code[def[v]].op = ASMO_ADD;
+		ir->code[def[v]].a.kind = ASMO_VAL;
+		ir->code[def[v]].a.val = 0;
+		ir->code[def[v]].b = val[v];
+		dead[def[v]] = 0;
+		val[v].kind = ASMO_REG;
+		val[v].val = v;
+	}
+	for (k = n = 0; k < ir->n; k++)
+		if (!dead[k])
+			ir->code[n++] = ir->code[k];
+	ir->simplified += ir->n - n;
+	ir->n = n;
+	free(val);
+	free(def);
+	free(dead);
+	return ir->simplified;
+}
 
-		case REM:
-			if (root->lhs->kind != CONSTANT && root->rhs->kind != CONSTANT) {
-				reg1 = codegen(root->lhs);
-				reg2 = codegen(root->rhs);
-				if (reg1 == reg2 || reg1 == -1)
-					return -1;
-				else {
-					reg = newReg();
-					printf("rem r%d r%d r%d\n", reg, reg1, reg2);
-				}
-				for (i = 0; i < 3; i++) {
-					if (reg1 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg1);;
-				for (i = 0; i < 3; i++) {
-					if (reg2 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg2);;
+size_t value_number(Compiler *c)
+{
+	IR *ir = &c->ir;
+	// repl[v]: the register v's uses are renamed to. table[h]: index + 1 of
+	// the instruction holding slot h, 0 if empty.
+	int *repl = (int*)malloc(sizeof(int) * (ir->vregs + 1));
+	size_t *table, size = 1, h, k, j, n;
+	char *dead = (char*)calloc(ir->n + 1, 1);
+	Operand t;
+	int v;
+
+	for (v = 0; v < ir->vregs; v++)
+		repl[v] = v;
+	while (size < 2 * ir->n)
+		size *= 2;
+	table = (size_t*)calloc(size, sizeof(size_t));
+	for (k = 0; k < ir->n; k++) {
+		IRInst *in = &ir->code[k];
+		if (in->a.kind == ASMO_REG)
+			in->a.val = repl[in->a.val];
+		if (in->b.kind == ASMO_REG)
+			in->b.val = repl[in->b.val];
+		if (in->op == ASMO_STORE || in->op == ASMO_CE)
+			continue;
+		if ((in->op == ASMO_ADD || in->op == ASMO_MUL) && (in->a.kind > in->b.kind
+			|| (in->a.kind == in->b.kind && in->a.val > in->b.val))) {
+			t = in->a;
+			in->a = in->b;
+			in->b = t;
+		}
+		h = ((unsigned)in->op * 131u + (unsigned)in->a.val * 31u + (unsigned)in->b.val) & (size - 1);
+		for (; table[h]; h = (h + 1) & (size - 1)) {
+			j = table[h] - 1;
+			if (ir->code[j].op == in->op && operand_equal(ir->code[j].a, in->a) && operand_equal(ir->code[j].b, in->b))
+				break;
+		}
+		if (!table[h]) {
+			table[h] = k + 1;
+			continue;
+		}
+		repl[in->dst.val] = ir->code[table[h] - 1].dst.val;
+		dead[k] = 1;
+		ir->numbered_cycles += inst_cost[in->op];
+	}
+	for (k = n = 0; k < ir->n; k++)
+		if (!dead[k])
+			ir->code[n++] = ir->code[k];
+	k = ir->n - n;
+	ir->numbered += k;
+	ir->n = n;
+	free(repl);
+	free(table);
+	free(dead);
+	return k;
+}
+
+size_t eliminate_dead(Compiler *c)
+{
+	IR *ir = &c->ir;
+	char *live, *keep;
+	size_t *def, k, n;
+
+	// A failed program is printed as it is, up to the error.
+	if (ir->n == 0 || ir->code[ir->n - 1].op == ASMO_CE)
+		return 0;
+	live = (char*)calloc(ir->vregs + 1, 1);
+	keep = (char*)calloc(ir->n + 1, 1);
+	def = (size_t*)malloc(sizeof(size_t) * (ir->vregs + 1));
+	for (k = 0; k < ir->n; k++)
+		if (ir->code[k].dst.kind == ASMO_REG)
+			def[ir->code[k].dst.val] = k;
+	for (k = ir->n; k-- > 0;) {
+		IRInst *in = &ir->code[k];
+		if (in->op == ASMO_STORE) {
+			IRInst *src = &ir->code[def[in->a.val]];
+			if (src->op == ASMO_LOAD && src->a.val == in->dst.val) {
+				ir->clean++;
+				continue;
 			}
-			else if (root->lhs->kind == CONSTANT && root->rhs->kind != CONSTANT) {
-				reg2 = codegen(root->rhs);
-				if (root->lhs->val == 0)
-					return -1;
-				else {
-					reg = newReg();
-					printf("rem r%d %d r%d\n", reg, root->lhs->val, reg2);
-				}
-				for (i = 0; i < 3; i++) {
-					if (reg2 == var_reg_ref[i])
+			keep[k] = 1;
+		}
+		else if (live[in->dst.val])
+			keep[k] = 1;
+		else if ((in->op == ASMO_DIV || in->op == ASMO_REM) && (in->b.kind != ASMO_VAL || in->b.val == 0 || in->b.val == -1))
+			keep[k] = 1;
+		if (!keep[k])
+			continue;
+		if (in->a.kind == ASMO_REG)
+			live[in->a.val] = 1;
+		if (in->b.kind == ASMO_REG)
+			live[in->b.val] = 1;
+	}
+	for (k = n = 0; k < ir->n; k++)
+		if (keep[k])
+			ir->code[n++] = ir->code[k];
+	k = ir->n - n;
+	ir->eliminated += k;
+	ir->n = n;
+	free(live);
+	free(keep);
+	free(def);
+	return k;
+}
+
+size_t fuse_divrem(Compiler *c)
+{
+	IR *ir = &c->ir;
+	IRInst *code = ir->code, in;
+	size_t n = ir->n, k, j, size = 1, h, fused = 0;
+	// div[h]: index + 1 of the first a / b hashing to slot h, 0 if empty.
+	// moved[k]: the division at k was moved up to a remainder.
+	size_t *div;
+	char *moved = (char*)calloc(n + 1, 1);
+	int t;
+
+	if (inst_cost[ASMO_MUL] + inst_cost[ASMO_SUB] >= inst_cost[ASMO_REM]) {
+		free(moved);
+		return 0;
+	}
+	while (size < 2 * n)
+		size *= 2;
+	div = (size_t*)calloc(size, sizeof(size_t));
+	for (k = 0; k < n; k++) {
+		if (code[k].op != ASMO_DIV)
+			continue;
+		h = ((unsigned)code[k].a.val * 31u + (unsigned)code[k].b.val) & (size - 1);
+		while (div[h] && !(operand_equal(code[div[h] - 1].a, code[k].a) && operand_equal(code[div[h] - 1].b, code[k].b)))
+			h = (h + 1) & (size - 1);
+		if (!div[h])
+			div[h] = k + 1;
+	}
+	ir->code = NULL;
+	ir->n = ir->cap = 0;
+	for (k = 0; k < n; k++) {
+		in = code[k];
+		if (moved[k])
+			continue;
+		if (in.op != ASMO_REM) {
+			ir_add(c, in.op, OP(in.dst), OP(in.a), OP(in.b));
+			ir->code[ir->n - 1].stmt = in.stmt;
+			continue;
+		}
+		h = ((unsigned)in.a.val * 31u + (unsigned)in.b.val) & (size - 1);
+		while (div[h] && !(operand_equal(code[div[h] - 1].a, in.a) && operand_equal(code[div[h] - 1].b, in.b)))
+			h = (h + 1) & (size - 1);
+		if (!div[h]) {
+			ir_add(c, in.op, OP(in.dst), OP(in.a), OP(in.b));
+			ir->code[ir->n - 1].stmt = in.stmt;
+			continue;
+		}
+		j = div[h] - 1;
+		// Its operands are defined before the remainder, so the division
+		// can move here.
+		if (j > k && !moved[j]) {
+			moved[j] = 1;
+			ir_add(c, ASMO_DIV, OP(code[j].dst), OP(in.a), OP(in.b));
+			ir->code[ir->n - 1].stmt = in.stmt;
+		}
+		t = new_vreg(c);
+		ir_add(c, ASMO_MUL, R(t), OP(code[j].dst), OP(in.b));
+		ir->code[ir->n - 1].stmt = in.stmt;
+		ir_add(c, ASMO_SUB, OP(in.dst), OP(in.a), R(t));
+		ir->code[ir->n - 1].stmt = in.stmt;
+		fused++;
+	}
+	ir->fused += fused;
+	free(code);
+	free(div);
+	free(moved);
+	return fused;
+}
+
+int operand_equal(Operand a, Operand b)
+{
+	return a.kind == b.kind && a.val == b.val;
+}
+
+size_t strength_reduce(Compiler *c)
+{
+	IR *ir = &c->ir;
+	IRInst *code = ir->code, in;
+	size_t n = ir->n, k, reduced = 0;
+	int *last = (int*)malloc(sizeof(int) * (ir->vregs + 1));
+	int *vals = (int*)malloc(sizeof(int) * (CHAIN_MAX + 1));
+	int *dies = (int*)calloc(n + 1, sizeof(int));
+	Chain chains[2 * CHAIN_RANGE + 1], now;
+	int live = 0, i, j, x, kv, mul_cost, chain_cost, reg[CHAIN_MAX + 1];
+
+	for (i = 0; i <= 2 * CHAIN_RANGE; i++)
+		chains[i].len = 0;
+	now.len = 0;
+	vals[0] = 1;
+	find_chains(chains, &now, vals);
+	ir_last_use(ir, last);
+	// dies[k]: values whose last use is instruction k, for the live count.
+	for (i = 0; i < ir->vregs; i++)
+		if (last[i] >= 0)
+			dies[last[i]]++;
+	ir->code = NULL;
+	ir->n = ir->cap = 0;
+	for (k = 0; k < n; k++) {
+		in = code[k];
+		live -= dies[k];
+		if (in.dst.kind == ASMO_REG)
+			live++;
+		if (in.op != ASMO_MUL || in.a.kind == in.b.kind || (in.a.kind != ASMO_VAL && in.b.kind != ASMO_VAL)) {
+			ir_add(c, in.op, OP(in.dst), OP(in.a), OP(in.b));
+			ir->code[ir->n - 1].stmt = in.stmt;
+			continue;
+		}
+		x = in.a.kind == ASMO_REG ? in.a.val : in.b.val;
+		kv = in.a.kind == ASMO_VAL ? in.a.val : in.b.val;
+		chain_cost = mul_cost = -1;
+		if (-CHAIN_RANGE <= kv && kv <= CHAIN_RANGE && chains[kv + CHAIN_RANGE].len > 0) {
+			Chain *ch = &chains[kv + CHAIN_RANGE];
+			// A negative factor costs legalize() one more sub (two for INT_MIN).
+			mul_cost = inst_cost[ASMO_MUL] * (live > PENALTY_REG ? PENALTY_FACTOR : 1);
+			if (kv < 0)
+				mul_cost += inst_cost[ASMO_SUB] * (live > PENALTY_REG ? PENALTY_FACTOR : 1);
+			chain_cost = 0;
+			for (i = 0; i < ch->len; i++)
+				chain_cost += inst_cost[ch->step[i].op] * (live + ch->extra > PENALTY_REG ? PENALTY_FACTOR : 1);
+		}
+		if (chain_cost < 0 || chain_cost >= mul_cost) {
+			ir_add(c, in.op, OP(in.dst), OP(in.a), OP(in.b));
+			ir->code[ir->n - 1].stmt = in.stmt;
+			continue;
+		}
+		Chain *ch = &chains[kv + CHAIN_RANGE];
+		reg[0] = x;
+		for (i = 0; i < ch->len; i++) {
+			reg[i + 1] = i + 1 == ch->len ? in.dst.val : new_vreg(c);
+			j = ch->step[i].a;
+			if (j < 0)
+				ir_add(c, ch->step[i].op, R(reg[i + 1]), V(0), R(reg[ch->step[i].b]));
+			else
+				ir_add(c, ch->step[i].op, R(reg[i + 1]), R(reg[j]), R(reg[ch->step[i].b]));
+			ir->code[ir->n - 1].stmt = in.stmt;
+		}
+		reduced++;
+		ir->saved += mul_cost - chain_cost;
+	}
+	ir->reduced += reduced;
+	free(code);
+	free(last);
+	free(vals);
+	free(dies);
+	return reduced;
+}
+
+void find_chains(Chain *chains, Chain *now, int *val)
+{
+	int n = now->len, a, b, op, k, i, j, live, extra;
+	Chain *best;
+
+	if (n > 0 && -CHAIN_RANGE <= val[n] && val[n] <= CHAIN_RANGE) {
+		// extra: the most chain values a step keeps live besides its result.
+		extra = 0;
+		for (i = 1; i <= n; i++) {
+			live = 0;
+			for (j = 1; j < i; j++)
+				for (k = i; k < n; k++)
+					if (now->step[k].a == j || now->step[k].b == j) {
+						live++;
 						break;
-				}
-				if (i >= 3)
-					freeReg(reg2);;
+					}
+			if (live > extra)
+				extra = live;
+		}
+		best = &chains[val[n] + CHAIN_RANGE];
+		if (best->len == 0 || n < best->len || (n == best->len && extra < best->extra)) {
+			*best = *now;
+			best->extra = extra;
+		}
+	}
+	if (n == CHAIN_MAX)
+		return;
+	for (op = ASMO_ADD; op <= ASMO_SUB; op++)
+		for (a = op == ASMO_SUB ? -1 : 0; a <= n; a++)
+			for (b = op == ASMO_ADD ? a : 0; b <= n; b++) {
+				if (op == ASMO_SUB && a == b)
+					continue;
+				now->step[n].op = op;
+				now->step[n].a = a;
+				now->step[n].b = b;
+				val[n + 1] = (a < 0 ? 0 : val[a]) + (op == ASMO_ADD ? val[b] : -val[b]);
+				now->len = n + 1;
+				find_chains(chains, now, val);
 			}
-			else if (root->lhs->kind != CONSTANT && root->rhs->kind == CONSTANT) {
-				reg1 = codegen(root->lhs);
-				if (reg1 == -1 || root->lhs->val == 1)
-					return -1;
-				else {
-					reg = newReg();
-					printf("rem r%d r%d %d\n", reg, reg1, root->rhs->val);
-				}
-				for (i = 0; i < 3; i++) {
-					if (reg1 == var_reg_ref[i])
-						break;
-				}
-				if (i >= 3)
-					freeReg(reg1);;
+	now->len = n;
+}
+
+void ir_last_use(IR *ir, int *last)
+{
+	Operand *o[3];
+	size_t k;
+	int i;
+
+	for (i = 0; i < ir->vregs; i++)
+		last[i] = -1;
+	for (k = 0; k < ir->n; k++) {
+		o[0] = &ir->code[k].dst;
+		o[1] = &ir->code[k].a;
+		o[2] = &ir->code[k].b;
+		for (i = 0; i < 3; i++)
+			if (o[i]->kind == ASMO_REG)
+				last[o[i]->val] = k;
+	}
+}
+
+void legalize(Compiler *c)
+{
+	IR *ir = &c->ir;
+	IRInst *code = ir->code, in;
+	size_t n = ir->n, k;
+
+	ir->code = NULL;
+	ir->n = ir->cap = 0;
+	for (k = 0; k < n; k++) {
+		in = code[k];
+		if (in.op == ASMO_ADD && in.a.kind == ASMO_VAL && in.a.val == 0 && in.b.kind == ASMO_VAL && in.b.val == INT_MIN) {
+			negative_reg(c, INT_MIN, in.stmt, in.dst.val);
+			continue;
+		}
+		if (in.op == ASMO_ADD || in.op == ASMO_SUB) {
+			if (in.op == ASMO_ADD && in.a.kind == ASMO_VAL && in.a.val < 0 && in.b.kind == ASMO_REG) {
+				in.a = in.b;
+				in.b = code[k].a;
 			}
-			else {
-				if (root->lhs->val == 0 || root->rhs->val == 1)
-					return -1;
-				else {
-					reg = newReg();
-					printf("rem r%d %d %d\n", reg, root->lhs->val, root->rhs->val);
-				}
+			if (in.b.kind == ASMO_VAL && in.b.val < 0 && in.b.val != INT_MIN) {
+				in.op = in.op == ASMO_ADD ? ASMO_SUB : ASMO_ADD;
+				in.b.val = -in.b.val;
 			}
-			return reg;
-
-		case PREINC:
-			reg = codegen(root->mid);
-			return reg;
+		}
+		if (in.a.kind == ASMO_VAL && in.a.val < 0) {
+			in.a.kind = ASMO_REG;
+			in.a.val = negative_reg(c, in.a.val, in.stmt, -1);
+		}
+		if (in.b.kind == ASMO_VAL && in.b.val < 0) {
+			in.b.kind = ASMO_REG;
+			in.b.val = negative_reg(c, in.b.val, in.stmt, -1);
+		}
+		ir_add(c, in.op, OP(in.dst), OP(in.a), OP(in.b));
+		ir->code[ir->n - 1].stmt = in.stmt;
+	}
+	free(code);
+}
 
-		case PREDEC:
-			reg = codegen(root->mid);
-			return reg;
+int negative_reg(Compiler *c, int k, int stmt, int reg)
+{
+	int tmp;
+
+	if (reg < 0)
+		reg = new_vreg(c);
+	if (k != INT_MIN) {
+		ir_add(c, ASMO_SUB, R(reg), V(0), V(-k));
+		c->ir.code[c->ir.n - 1].stmt = stmt;
+		return reg;
+	}
+	// INT_MIN has no positive counterpart: it is (0 - INT_MAX) - 1.
+	tmp = new_vreg(c);
+	ir_add(c, ASMO_SUB, R(tmp), V(0), V(INT_MAX));
+	c->ir.code[c->ir.n - 1].stmt = stmt;
+	ir_add(c, ASMO_SUB, R(reg), R(tmp), V(1));
+	c->ir.code[c->ir.n - 1].stmt = stmt;
+	return reg;
+}
 
-		case POSTINC:
-			tmp = root->mid;
-			while (tmp->kind == LPAR)
-				tmp = tmp->mid;
-			if (tmp->val == 'x')
-				var_alter[0]++;
-			else if (tmp->val == 'y')
-				var_alter[1]++;
-			else 
-				var_alter[2]++;
-			return codegen(tmp);
+Operand fold(const IRInst *in)
+{
+	Operand a = in->a, b = in->b, res = {ASMO_NONE, 0};
+	int a0 = a.kind == ASMO_VAL && a.val == 0, b0 = b.kind == ASMO_VAL && b.val == 0;
+	int b1 = b.kind == ASMO_VAL && (b.val == 1 || b.val == -1);
+	int same = a.kind == b.kind && a.val == b.val;
+	unsigned x = a.val, y = b.val;
+
+	if (a.kind == ASMO_VAL && b.kind == ASMO_VAL) {
+		res.kind = ASMO_VAL;
+		// Wrap around as the machine does. A division that would trap is left to trap.
+		switch (in->op) {
+			case ASMO_ADD: res.val = (int)(x + y); return res;
+			case ASMO_SUB: res.val = (int)(x - y); return res;
+			case ASMO_MUL: res.val = (int)(x * y); return res;
+			case ASMO_DIV:
+			case ASMO_REM:
+				if (b.val == 0 || (a.val == INT_MIN && b.val == -1))
+					break;
+				res.val = in->op == ASMO_DIV ? a.val / b.val : a.val % b.val;
+				return res;
+			default: break;
+		}
+		res.kind = ASMO_NONE;
+		return res;
+	}
+	// With a register operand, C lets us assume a division does not trap.
+	switch (in->op) {
+		case ASMO_ADD:
+			if (a0) return b;
+			if (b0) return a;
+			break;
+		case ASMO_SUB:
+			if (b0) return a;
+			if (same) res.kind = ASMO_VAL;
+			break;
+		case ASMO_MUL:
+			if (a0 || b0) res.kind = ASMO_VAL;
+			else if (a.kind == ASMO_VAL && a.val == 1) return b;
+			else if (b.kind == ASMO_VAL && b.val == 1) return a;
+			break;
+		case ASMO_DIV:
+			if (a0) res.kind = ASMO_VAL;
+			else if (b.kind == ASMO_VAL && b.val == 1) return a;
+			else if (same) {
+				res.kind = ASMO_VAL;
+				res.val = 1;
+			}
+			break;
+		case ASMO_REM:
+			if (a0 || b1 || same) res.kind = ASMO_VAL;
+			break;
+		default: break;
+	}
+	return res;
+}
 
-		case POSTDEC:
-			tmp = root->mid;
-			while (tmp->kind == LPAR)
-				tmp = tmp->mid;
-			if (tmp->val == 'x')
-				var_alter[0]--;
-			else if (tmp->val == 'y')
-				var_alter[1]--;
-			else 
-				var_alter[2]--;
-			return codegen(tmp);
+void emit_program(Compiler *c)
+{
+	IR *ir = &c->ir;
+	int *last = (int*)malloc(sizeof(int) * (ir->vregs + 1));
+	int *phys = (int*)malloc(sizeof(int) * (ir->vregs + 1));
+	size_t k, done;
+
+	ir_last_use(ir, last);
+	if (c->stats) {
+		done = allocate(c, last, phys, 0);
+		ir->penalty_lowest += penalty_cycles(ir, done, phys);
+	}
+	done = allocate(c, last, phys, 1);
+	ir->penalty += penalty_cycles(ir, done, phys);
+	for (k = 0; k < ir->n; k++) {
+		IRInst in = ir->code[k];
+		if (in.op == ASMO_CE || k == done) {
+			emit(c, ASMO_CE, NONE, NONE, NONE);
+			break;
+		}
+		if (in.dst.kind == ASMO_REG)
+			in.dst.val = phys[in.dst.val];
+		if (in.a.kind == ASMO_REG)
+			in.a.val = phys[in.a.val];
+		if (in.b.kind == ASMO_REG)
+			in.b.val = phys[in.b.val];
+		emit(c, in.op, OP(in.dst), OP(in.a), OP(in.b));
+	}
+	free(last);
+	free(phys);
+}
 
-		case IDENTIFIER:
-			if (root->val == 'x') {
-				if (var_reg_ref[0] < 0) {
-					reg = newReg();
-					printf("load r%d [0]\n", reg);
-					var_reg_ref[0] = reg;
+size_t allocate(Compiler *c, const int *last, int *phys, int weighted)
+{
+	IR *ir = &c->ir;
+	Interval *iv = NULL;
+	// low[v]: v gets r0-r7. used: bit i set while ri of r0-r7 is taken.
+	char *low = (char*)calloc(ir->vregs + 1, 1);
+	int *mx, *lz, i, n = 0, reg;
+	unsigned used = 0;
+	Operand *o[3];
+	size_t k;
+
+	reg_reset(c);
+	if (weighted && ir->n > 0) {
+		iv = (Interval*)malloc(sizeof(Interval) * (ir->vregs + 1));
+		for (i = 0; i < ir->vregs; i++)
+			iv[i].weight = -1;
+		for (k = 0; k < ir->n && ir->code[k].op != ASMO_CE; k++) {
+			IRInst *in = &ir->code[k];
+			o[0] = &in->dst;
+			o[1] = &in->a;
+			o[2] = &in->b;
+			for (i = 0; i < 3; i++) {
+				if (o[i]->kind != ASMO_REG)
+					continue;
+				if (i == 0) {
+					iv[o[0]->val].weight = 0;
+					iv[o[0]->val].def = k;
 				}
-				else
-					reg = var_reg_ref[0];
+				iv[o[i]->val].weight += inst_cost[in->op];
 			}
-			else if (root->val == 'y') {
-				if (var_reg_ref[1] < 0) {
-					reg = newReg();
-					printf("load r%d [4]\n", reg);
-					var_reg_ref[1] = reg;
-				}
-				else
-					reg = var_reg_ref[1];
+		}
+		// Only values still defined take part; pack them to the front.
+		for (i = 0; i < ir->vregs; i++)
+			if (iv[i].weight >= 0) {
+				iv[n] = iv[i];
+				iv[n].v = i;
+				iv[n].end = last[i] > iv[n].def ? last[i] : iv[n].def + 1;
+				n++;
 			}
-			else {
-				if (var_reg_ref[2] < 0) {
-					reg = newReg();
-					printf("load r%d [8]\n", reg);
-					var_reg_ref[2] = reg;
-				}
-				else
-					reg = var_reg_ref[2];
+		qsort(iv, n, sizeof(Interval), interval_cmp);
+		// A value goes low if at most seven others already chosen are live
+		// anywhere in its range. Interval graphs need no more colors than
+		// their widest point, so the chosen ones always fit in eight.
+		mx = (int*)calloc(4 * ir->n, sizeof(int));
+		lz = (int*)calloc(4 * ir->n, sizeof(int));
+		for (i = 0; i < n; i++)
+			if (seg_max(mx, lz, 1, 0, ir->n, iv[i].def, iv[i].end) < PENALTY_REG) {
+				seg_add(mx, lz, 1, 0, ir->n, iv[i].def, iv[i].end, 1);
+				low[iv[i].v] = 1;
 			}
-			return reg;
+		free(mx);
+		free(lz);
+		free(iv);
+		// r0-r7 are handed out from used, so newReg() only sees r8 and up.
+		for (i = 0; i < PENALTY_REG; i++)
+			c->reg_table[i] = c->reg_gen;
+	}
+	for (k = 0; k < ir->n && ir->code[k].op != ASMO_CE; k++) {
+		IRInst *in = &ir->code[k];
+		// Operands read for the last time give their registers back first, so
+		// the destination may reuse one of them.
+		o[1] = &in->a;
+		o[2] = &in->b;
+		for (i = 1; i < 3; i++) {
+			if (o[i]->kind != ASMO_REG || last[o[i]->val] != (int)k)
+				continue;
+			reg = phys[o[i]->val];
+			if (low[o[i]->val])
+				used &= ~(1u << reg);
+			else
+				freeReg(c, reg);
+		}
+		if (in->dst.kind != ASMO_REG)
+			continue;
+		if (low[in->dst.val]) {
+			for (reg = 0; used >> reg & 1; reg++)
+				;
+			used |= 1u << reg;
+		}
+		else if ((reg = newReg(c)) < 0)
+			break;
+		phys[in->dst.val] = reg;
+		if (last[in->dst.val] == (int)k) {
+			if (low[in->dst.val])
+				used &= ~(1u << reg);
+			else
+				freeReg(c, reg);
+		}
+	}
+	free(low);
+	return k;
+}
 
-		case CONSTANT:
-			if (root->val == 0)
-				return -1;
-			else {
-				reg = newReg();
-				printf("add r%d 0 %d\n", reg, root->val);
-			}
-			return reg;
+int interval_cmp(const void *a, const void *b)
+{
+	const Interval *x = (const Interval*)a, *y = (const Interval*)b;
 
-		case LPAR:
-			tmp = root;
-			while (tmp->kind == LPAR)
-				tmp = tmp->mid;
-			reg = codegen(tmp);
-			return reg;
+	if (x->weight != y->weight)
+		return x->weight > y->weight ? -1 : 1;
+	if (x->end - x->def != y->end - y->def)
+		return x->end - x->def < y->end - y->def ? -1 : 1;
+	return x->v - y->v;
+}
 
-		case PLUS:
-			return codegen(root->mid);
+void seg_add(int *mx, int *lz, int node, int lo, int hi, int l, int r, int d)
+{
+	int mid = lo + (hi - lo) / 2;
 
-		case MINUS:
-			reg2 = codegen(root->mid);
-			if (reg2 == -1)
-				return -1;
-			else {
-				reg1 = newReg();
-				printf("sub r%d 0 r%d\n", reg1, reg2);
-			}
-			return reg1;
+	if (r <= lo || hi <= l)
+		return;
+	if (l <= lo && hi <= r) {
+		mx[node] += d;
+		lz[node] += d;
+		return;
+	}
+	seg_add(mx, lz, 2 * node, lo, mid, l, r, d);
+	seg_add(mx, lz, 2 * node + 1, mid, hi, l, r, d);
+	mx[node] = lz[node] + (mx[2 * node] > mx[2 * node + 1] ? mx[2 * node] : mx[2 * node + 1]);
+}
 
-		default: ;
+int seg_max(int *mx, int *lz, int node, int lo, int hi, int l, int r)
+{
+	int mid = lo + (hi - lo) / 2, a, b;
+
+	if (r <= lo || hi <= l)
+		return 0;
+	if (l <= lo && hi <= r)
+		return mx[node];
+	a = seg_max(mx, lz, 2 * node, lo, mid, l, r);
+	b = seg_max(mx, lz, 2 * node + 1, mid, hi, l, r);
+	return lz[node] + (a > b ? a : b);
+}
+
+long penalty_cycles(const IR *ir, size_t n, const int *phys)
+{
+	long sum = 0;
+	size_t k;
+
+	for (k = 0; k < n; k++) {
+		const IRInst *in = &ir->code[k];
+		if ((in->dst.kind == ASMO_REG && phys[in->dst.val] >= PENALTY_REG)
+			|| (in->a.kind == ASMO_REG && phys[in->a.val] >= PENALTY_REG)
+			|| (in->b.kind == ASMO_REG && phys[in->b.val] >= PENALTY_REG))
+			sum += inst_cost[in->op] * (PENALTY_FACTOR - 1);
 	}
-	err("Invalid AST node in tree.");
+	return sum;
+}
 
-	return -1;
+void reg_reset(Compiler *c)
+{
+	if (++c->reg_gen == 0) {
+		memset(c->reg_table, 0, sizeof(c->reg_table));
+		c->reg_gen = 1;
+	}
 }
 
-int newReg()
+int newReg(Compiler *c)
 {
 	int i;
 
 	for (i = 0; i < MAX_REG; i++) {
-		if (!reg_table[i]) {
-			reg_table[i] = 1;
+		if (c->reg_table[i] != c->reg_gen) {
+			c->reg_table[i] = c->reg_gen;
 			return i;
 		}
 	}
 
-	err("Register depleted.");
+	return -1;
 }
 
-void freeReg(int reg)
+void freeReg(Compiler *c, int reg)
 {
 	if (reg != -1)
-		reg_table[reg] = 0;
+		c->reg_table[reg] = 0;
 	
 	return ;
 }
 
-void IncDec()
+void IncDec(Compiler *c)
 {
 	int reg;
 	int i;
 
 	for (i = 0; i < 3; i++) {
-		if (var_alter[i] != 0) {
-			if (var_reg_ref[i] < 0) {
-				reg = newReg();
-				printf("load r%d [%d]\n", reg, i * 4);
+		if (c->var_alter[i] != 0) {
+			if (c->var_reg_ref[i] < 0) {
+				c->var_reg_ref[i] = new_vreg(c);
+				ir_add(c, ASMO_LOAD, R(c->var_reg_ref[i]), M(i * 4), NONE);
 			}
+			reg = new_vreg(c);
+			if (c->var_alter[i] > 0)
+				ir_add(c, ASMO_ADD, R(reg), R(c->var_reg_ref[i]), V(c->var_alter[i]));
 			else
-				reg = var_reg_ref[i];
-			if (var_alter[i] > 0)
-				printf("add r%d r%d %d\n", reg, reg, var_alter[i]);
-			else
-				printf("sub r%d r%d %d\n", reg, reg, var_alter[i] * -1);
-			var_reg_ref[i] = reg;
-			var_alter[i] = 0;
+				ir_add(c, ASMO_SUB, R(reg), R(c->var_reg_ref[i]), V(c->var_alter[i] * -1));
+			c->var_reg_ref[i] = reg;
+			c->var_alter[i] = 0;
 		}
 	}
 
@@ -1006,14 +2010,126 @@ void IncDec()
 }
 //*/
 
-// Free the whole AST.
-void freeAST(AST *now) 
+// Print one instruction line, or its binary record with "-b".
+void emit(Compiler *c, AsmoOp op, AsmoKind kd, int d, AsmoKind ka, int a, AsmoKind kb, int b)
+{
+	AsmoInst in;
+
+	in.op = op;
+	in.kind = ASMO_KIND(kd, ka, kb);
+	in.pad = 0;
+	in.a = a;
+	in.b = b;
+	in.d = d;
+	// A record holds operand 0 in a byte, and "r-1" or "[-4]" does not encode.
+	// Such an instruction goes out invalid, and the reader rejects it there.
+	if (op != ASMO_CE && (d < 0 || d > 0xFF || (ka != ASMO_VAL && a < 0) || (kb != ASMO_VAL && b < 0))) {
+		memset(&in, 0, sizeof(in));
+		in.op = ASMO_INVALID;
+	}
+	emitter_put(&c->out, &in);
+}
+
+void emitter_init(Emitter *e, EmitTarget target, FILE *file)
+{
+	memset(e, 0, sizeof(*e));
+	e->target = target;
+	e->file = file;
+	e->buf = (char*)malloc(EMIT_BUFFER);
+	if (target == EMIT_OBJECT) {
+		AsmoHeader h = {{'A', 'S', 'M', 'O'}, ASMO_VERSION, {0, 0}};
+		memcpy(e->buf, &h, sizeof(h));
+		e->len = sizeof(h);
+	}
+}
+
+void emitter_put(Emitter *e, const AsmoInst *in)
+{
+	char *p;
+
+	e->insts++;
+	// The longest line, "store [-2147483648] r-2147483648\n", fits in 64 bytes.
+	if (e->len + 64 > EMIT_BUFFER)
+		emitter_flush(e);
+	p = e->buf + e->len;
+	if (e->target == EMIT_OBJECT) {
+		memcpy(p, in, sizeof(*in));
+		e->len += sizeof(*in);
+		return ;
+	}
+	if (in->op > ASMO_LOAD) {
+		const char *line = in->op == ASMO_CE ? "Compile Error!\n" : "?\n";
+		memcpy(p, line, strlen(line));
+		e->len += strlen(line);
+		return ;
+	}
+	for (const char *s = asmo_name[in->op]; *s; s++)
+		*p++ = *s;
+	for (int i = 0; i < 3; i++) {
+		AsmoKind kind = ASMO_KIND_OF(in->kind, i);
+		int val = i == 0 ? in->d : i == 1 ? in->a : in->b;
+		if (kind == ASMO_NONE)
+			break;
+		*p++ = ' ';
+		if (kind == ASMO_REG)
+			*p++ = 'r';
+		else if (kind == ASMO_MEM)
+			*p++ = '[';
+		p = format_int(p, val);
+		if (kind == ASMO_MEM)
+			*p++ = ']';
+	}
+	*p++ = '\n';
+	e->len = p - e->buf;
+}
+
+void emitter_flush(Emitter *e)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	if (e->len == 0)
+		return ;
+	// Anything the FILE still buffers goes first.
+	fflush(e->file);
+	while (e->error == 0 && done < e->len) {
+		n = write(fileno(e->file), e->buf + done, e->len - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			e->error = n < 0 ? errno : EIO;
+			break;
+		}
+		done += n;
+		e->writes++;
+	}
+	e->bytes += done;
+	e->len = 0;
+}
+
+void emitter_free(Emitter *e)
+{
+	if (e->buf != NULL)
+		emitter_flush(e);
+	free(e->buf);
+	e->buf = NULL;
+}
+
+char *format_int(char *p, int val)
 {
-	if (now == NULL) return;
-	freeAST(now->lhs);
-	freeAST(now->mid);
-	freeAST(now->rhs);
-	free(now);
+	char tmp[10];
+	unsigned u = val < 0 ? 0u - (unsigned)val : (unsigned)val;
+	int n = 0;
+
+	if (val < 0)
+		*p++ = '-';
+	do {
+		tmp[n++] = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	while (n)
+		*p++ = tmp[--n];
+	return p;
 }
 
 // Print token array.
@@ -1125,7 +2241,7 @@ int optimize(AST *now)
 		return optimize(now->lhs) + optimize(now->mid) + optimize(now->rhs);
 }
 
-void modgen(AST *now)
+void modgen(Compiler *c, AST *now)
 {
 	AST *tmp;
 
@@ -1138,11 +2254,11 @@ void modgen(AST *now)
 			while (tmp->kind == LPAR)
 				tmp = tmp->mid;
 			if (tmp->val == 'x')
-				var_alter[0]++;
+				c->var_alter[0]++;
 			else if (tmp->val == 'y')
-				var_alter[1]++;
+				c->var_alter[1]++;
 			else 
-				var_alter[2]++;
+				c->var_alter[2]++;
 			return ;
 
 		case POSTDEC:
@@ -1151,21 +2267,21 @@ void modgen(AST *now)
 			while (tmp->kind == LPAR)
 				tmp = tmp->mid;
 			if (tmp->val == 'x')
-				var_alter[0]--;
+				c->var_alter[0]--;
 			else if (tmp->val == 'y')
-				var_alter[1]--;
+				c->var_alter[1]--;
 			else 
-				var_alter[2]--;
+				c->var_alter[2]--;
 			return ;
 		default:
-			modgen(now->lhs);
-			modgen(now->mid);
-			modgen(now->rhs);
+			modgen(c, now->lhs);
+			modgen(c, now->mid);
+			modgen(c, now->rhs);
 			return ;
 	}
 }
 
-void preIncDec(AST *now)
+void preIncDec(Compiler *c, AST *now)
 {
 	AST *tmp;
 
@@ -1176,38 +2292,38 @@ void preIncDec(AST *now)
 		while (tmp->kind == LPAR)
 			tmp = tmp->mid;
 		if (tmp->val == 'x')
-			var_alter[0]++;
+			c->var_alter[0]++;
 		else if (tmp->val == 'y')
-			var_alter[1]++;
+			c->var_alter[1]++;
 		else if (tmp->val == 'z')
-			var_alter[2]++;
+			c->var_alter[2]++;
 	}
 	else if (now->kind == PREDEC) {
 		tmp = now->mid;
 		while (tmp->kind == LPAR)
 			tmp = tmp->mid;
 		if (tmp->val == 'x')
-			var_alter[0]--;
+			c->var_alter[0]--;
 		else if (tmp->val == 'y')
-			var_alter[1]--;
+			c->var_alter[1]--;
 		else if (tmp->val == 'z')
-			var_alter[2]--;
+			c->var_alter[2]--;
 	}
 	else {
-		preIncDec(now->lhs);
-		preIncDec(now->mid);
-		preIncDec(now->rhs);
+		preIncDec(c, now->lhs);
+		preIncDec(c, now->mid);
+		preIncDec(c, now->rhs);
 	}
 
 	return ;
 }
 
-void finalIncDec()
+void finalIncDec(Compiler *c)
 {
 	int i;
 
 	for (i = 0; i < 3; i++) {
-		if (var_reg_ref[i] >= 0)
-			printf("store [%d] r%d\n", i * 4, var_reg_ref[i]);
+		if (c->var_reg_ref[i] >= 0)
+			ir_add(c, ASMO_STORE, M(i * 4), R(c->var_reg_ref[i]), NONE);
 	}
 }